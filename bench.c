@@ -9,6 +9,9 @@
 
 #include "ctaes.h"
 
+/* The number of blocks passed to every call in the bulk benchmarks. */
+#define BULK_BLOCKS 256
+
 static double gettimedouble(void) {
     struct timeval tv;
     gettimeofday(&tv, NULL);
@@ -93,6 +96,24 @@ static void bench_AES128_decrypt(void* data) {
     }
 }
 
+static void bench_AES128_encrypt_bulk(void* data) {
+    const AES128_ctx* ctx = (const AES128_ctx*)data;
+    unsigned char scratch[BULK_BLOCKS * 16] = {0};
+    int i;
+    for (i = 0; i < 4000000 / (BULK_BLOCKS * 16); i++) {
+        AES128_encrypt(ctx, BULK_BLOCKS, scratch, scratch);
+    }
+}
+
+static void bench_AES128_decrypt_bulk(void* data) {
+    const AES128_ctx* ctx = (const AES128_ctx*)data;
+    unsigned char scratch[BULK_BLOCKS * 16] = {0};
+    int i;
+    for (i = 0; i < 4000000 / (BULK_BLOCKS * 16); i++) {
+        AES128_decrypt(ctx, BULK_BLOCKS, scratch, scratch);
+    }
+}
+
 static void bench_AES192_init(void* data) {
     AES192_ctx* ctx = (AES192_ctx*)data;
     int i;
@@ -125,6 +146,24 @@ static void bench_AES192_decrypt(void* data) {
     }
 }
 
+static void bench_AES192_encrypt_bulk(void* data) {
+    const AES192_ctx* ctx = (const AES192_ctx*)data;
+    unsigned char scratch[BULK_BLOCKS * 16] = {0};
+    int i;
+    for (i = 0; i < 4000000 / (BULK_BLOCKS * 16); i++) {
+        AES192_encrypt(ctx, BULK_BLOCKS, scratch, scratch);
+    }
+}
+
+static void bench_AES192_decrypt_bulk(void* data) {
+    const AES192_ctx* ctx = (const AES192_ctx*)data;
+    unsigned char scratch[BULK_BLOCKS * 16] = {0};
+    int i;
+    for (i = 0; i < 4000000 / (BULK_BLOCKS * 16); i++) {
+        AES192_decrypt(ctx, BULK_BLOCKS, scratch, scratch);
+    }
+}
+
 static void bench_AES256_init(void* data) {
     AES256_ctx* ctx = (AES256_ctx*)data;
     int i;
@@ -158,6 +197,24 @@ static void bench_AES256_decrypt(void* data) {
     }
 }
 
+static void bench_AES256_encrypt_bulk(void* data) {
+    const AES256_ctx* ctx = (const AES256_ctx*)data;
+    unsigned char scratch[BULK_BLOCKS * 16] = {0};
+    int i;
+    for (i = 0; i < 4000000 / (BULK_BLOCKS * 16); i++) {
+        AES256_encrypt(ctx, BULK_BLOCKS, scratch, scratch);
+    }
+}
+
+static void bench_AES256_decrypt_bulk(void* data) {
+    const AES256_ctx* ctx = (const AES256_ctx*)data;
+    unsigned char scratch[BULK_BLOCKS * 16] = {0};
+    int i;
+    for (i = 0; i < 4000000 / (BULK_BLOCKS * 16); i++) {
+        AES256_decrypt(ctx, BULK_BLOCKS, scratch, scratch);
+    }
+}
+
 int main(void) {
     AES128_ctx ctx128;
     AES192_ctx ctx192;
@@ -165,11 +222,17 @@ int main(void) {
     run_benchmark("aes128_init", bench_AES128_init, NULL, NULL, &ctx128, 20, 50000);
     run_benchmark("aes128_encrypt_byte", bench_AES128_encrypt, bench_AES128_encrypt_setup, NULL, &ctx128, 20, 4000000);
     run_benchmark("aes128_decrypt_byte", bench_AES128_decrypt, bench_AES128_encrypt_setup, NULL, &ctx128, 20, 4000000);
+    run_benchmark("aes128_encrypt_bulk_byte", bench_AES128_encrypt_bulk, bench_AES128_encrypt_setup, NULL, &ctx128, 20, 4000000);
+    run_benchmark("aes128_decrypt_bulk_byte", bench_AES128_decrypt_bulk, bench_AES128_encrypt_setup, NULL, &ctx128, 20, 4000000);
     run_benchmark("aes192_init", bench_AES192_init, NULL, NULL, &ctx192, 20, 50000);
     run_benchmark("aes192_encrypt_byte", bench_AES192_encrypt, bench_AES192_encrypt_setup, NULL, &ctx192, 20, 4000000);
     run_benchmark("aes192_decrypt_byte", bench_AES192_decrypt, bench_AES192_encrypt_setup, NULL, &ctx192, 20, 4000000);
+    run_benchmark("aes192_encrypt_bulk_byte", bench_AES192_encrypt_bulk, bench_AES192_encrypt_setup, NULL, &ctx192, 20, 4000000);
+    run_benchmark("aes192_decrypt_bulk_byte", bench_AES192_decrypt_bulk, bench_AES192_encrypt_setup, NULL, &ctx192, 20, 4000000);
     run_benchmark("aes256_init", bench_AES256_init, NULL, NULL, &ctx256, 20, 50000);
     run_benchmark("aes256_encrypt_byte", bench_AES256_encrypt, bench_AES256_encrypt_setup, NULL, &ctx256, 20, 4000000);
     run_benchmark("aes256_decrypt_byte", bench_AES256_decrypt, bench_AES256_encrypt_setup, NULL, &ctx256, 20, 4000000);
+    run_benchmark("aes256_encrypt_bulk_byte", bench_AES256_encrypt_bulk, bench_AES256_encrypt_setup, NULL, &ctx256, 20, 4000000);
+    run_benchmark("aes256_decrypt_bulk_byte", bench_AES256_decrypt_bulk, bench_AES256_encrypt_setup, NULL, &ctx256, 20, 4000000);
     return 0;
 }
@@ -9,12 +9,27 @@
  *   Emilia Kasper and Peter Schwabe, Faster and Timing-Attack Resistant AES-GCM
  *   https://www.iacr.org/archive/ches2009/57470001/57470001.pdf
  * But using 8 16-bit integers representing a single AES state rather than 8 128-bit
- * integers representing 8 AES states.
+ * integers representing 8 AES states. When enough blocks are processed at once,
+ * 8 32-bit (64-bit) integers representing 2 (4) AES states, or with SSE2 (AVX2)
+ * 8 128-bit (256-bit) vectors representing 8 (16) AES states, are used instead.
+ * Single blocks use vector permute code on x86 CPUs with SSSE3, and x86 CPUs
+ * with AES-NI use it for everything.
  */
 
 #include "ctaes.h"
 
+#include <stdio.h>
 #include <string.h>
+#include <time.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+/* Whether to ignore instruction set extensions detected at runtime, see AES_set_portable. */
+static int use_portable = 0;
 
 /* Slice variable slice_i contains the i'th bit of the 16 state variables in this order:
  *  0  1  2  3
@@ -23,538 +38,1712 @@
  * 12 13 14 15
  */
 
-/** Convert a byte to sliced form, storing it corresponding to given row and column in s */
-static void LoadByte(AES_state* s, unsigned char byte, int r, int c) {
+/* A key schedule, as passed to the encryption and decryption code. */
+typedef struct {
+    const AES_state* rounds;           /* nrounds + 1 bit sliced round keys */
+    const unsigned char* rounds_bytes; /* the same round keys in byte order, or NULL (for decrypt_eq: the inverse cipher ones, see AES128_dec_ctx) */
+    int nrounds;
+    /* The same round keys as prepared by wide_load (a backend's load_keys), or NULL */
+    const void* wide_rounds;
+    void (*wide_load)(void* wide_rounds, const AES_state* rounds, int nrounds);
+} AES_keys;
+
+/** Set up keys for the given round keys, without prepared ones */
+static void InitKeys(AES_keys* keys, const AES_state* rounds, const unsigned char* rounds_bytes, int nrounds) {
+    keys->rounds = rounds;
+    keys->rounds_bytes = rounds_bytes;
+    keys->nrounds = nrounds;
+    keys->wide_rounds = NULL;
+    keys->wide_load = NULL;
+}
+
+static void LoadByteKeys(void* wide_rounds, const AES_state* rounds, int nrounds);
+static const unsigned char* ByteKeys(const AES_keys* keys, unsigned char* buf);
+
+/* The round functions, for a single block in 16-bit slices. */
+#define SLICE_T uint16_t
+#define SLICE_ELEM_T uint16_t
+#define SLICE_ELEMS 1
+#define SLICE_ELEM(x,e) (x)
+#define SLICE_LANES 1
+#define STATE_T AES_state
+#define BS(name) name
+#include "ctaes_bitslice_impl.h"
+
+/* The same round functions for 2 blocks at once, interleaved in 32-bit slices,
+ * and semi-fixsliced to avoid most ShiftRows. This is the widest code that fits the
+ * registers of 32-bit platforms, and handles pairs of blocks elsewhere. */
+typedef struct {
+    uint32_t slice[8];
+} AES_state_x2;
+
+#define SLICE_T uint32_t
+#define SLICE_ELEM_T uint32_t
+#define SLICE_ELEMS 1
+#define SLICE_ELEM(x,e) (x)
+#define SLICE_LANES 2
+#define STATE_T AES_state_x2
+#define BS(name) name##_x2
+#define SLICE_FIXSLICED 1
+#include "ctaes_bitslice_impl.h"
+
+#if UINTPTR_MAX > 0xFFFFFFFF
+/* On 64-bit platforms, the same round functions for 4 blocks at once, interleaved in 64-bit slices. */
+#define HAVE_X4 1
+
+typedef struct {
+    uint64_t slice[8];
+} AES_state_x4;
+
+#define SLICE_T uint64_t
+#define SLICE_ELEM_T uint64_t
+#define SLICE_ELEMS 1
+#define SLICE_ELEM(x,e) (x)
+#define SLICE_LANES 4
+#define STATE_T AES_state_x4
+#define BS(name) name##_x4
+#include "ctaes_bitslice_impl.h"
+#endif
+
+#if defined(__SSE2__) && defined(__GNUC__)
+/* With SSE2, the same round functions for 8 blocks at once, in the 128-bit
+ * slices of the original paper. Every slice is a vector of two 64-bit
+ * elements, each holding 4 blocks in the layout used above, so shifts and
+ * rotations never cross the 64-bit halves of the SSE2 registers. */
+#define HAVE_X8 1
+
+typedef uint64_t AES_slice_x8 __attribute__((vector_size(16)));
+
+typedef struct {
+    AES_slice_x8 slice[8];
+} AES_state_x8;
+
+#define SLICE_T AES_slice_x8
+#define SLICE_ELEM_T uint64_t
+#define SLICE_ELEMS 2
+#define SLICE_ELEM(x,e) (x)[e]
+#define SLICE_LANES 4
+#define STATE_T AES_state_x8
+#define BS(name) name##_x8
+#include "ctaes_bitslice_impl.h"
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+/* The same for 16 blocks at once in 256-bit AVX2 slices, compiled for AVX2
+ * regardless of the compiler flags, and only used when the CPU supports it. */
+#define HAVE_X16 1
+
+typedef uint64_t AES_slice_x16 __attribute__((vector_size(32)));
+
+typedef struct {
+    AES_slice_x16 slice[8];
+} AES_state_x16;
+
+#define SLICE_T AES_slice_x16
+#define SLICE_ELEM_T uint64_t
+#define SLICE_ELEMS 4
+#define SLICE_ELEM(x,e) (x)[e]
+#define SLICE_LANES 4
+#define STATE_T AES_state_x16
+#define BS(name) name##_x16
+#define SLICE_TARGET __attribute__((target("avx2")))
+#include "ctaes_bitslice_impl.h"
+
+static int HaveAVX2(void) {
+    return !use_portable && __builtin_cpu_supports("avx2");
+}
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+/* Vector permute AES, based on:
+ *   Mike Hamburg, Accelerating AES with Vector Permute Instructions
+ *   https://shiftleft.org/papers/vector_aes/vector_aes.pdf
+ * A single block is kept in a 128-bit register in byte order, and the S-box
+ * is computed with SSSE3 PSHUFB instructions, each a lookup of 16 4-bit indices
+ * in a 16-byte table, so no memory is indexed by secret data. This has much
+ * lower latency than the bit sliced code for one block, so it handles the
+ * blocks left over when a state cannot be filled. Compiled for SSSE3
+ * regardless of the compiler flags, and only used when the CPU supports it.
+ *
+ * The S-box inverts x in GF(2^8) represented over GF(2^4), as x = i*t + j*t^16
+ * for i and j in GF(2^4) and t = 0x12, which has t + t^16 = 1. With k = i + j,
+ * N = t^17 and a = 1/N, the values io = j + 1/(1/i + a/k) and
+ * jo = i + 1/(1/j + a/k) satisfy 1/x = (1/io)*(t^16 + N) + (1/jo)*(t + N).
+ * The elements of GF(2^4) are stored as 4-bit numbers in the basis 1, g, g^2,
+ * g^3 for g = 0x0d. Divisions by zero give 0x80, which is passed on by the xors
+ * (or the 1/(1/i + a/k) lookup maps back to zero) and makes PSHUFB return 0, so
+ * 0 inverts to 0. The tables that convert into this representation and back
+ * also apply the affine transform of the S-box, or its inverse.
+ */
+#define HAVE_VPERM 1
+#define VPERM_TARGET __attribute__((target("ssse3")))
+
+/* The tables for the GF(2^4) arithmetic: 1/x and a/x. */
+static const uint8_t vperm_inv[16] = {0x80, 0x01, 0x0c, 0x08, 0x06, 0x0f, 0x04, 0x0e, 0x03, 0x0d, 0x0b, 0x0a, 0x02, 0x09, 0x07, 0x05};
+static const uint8_t vperm_inva[16] = {0x80, 0x0c, 0x06, 0x04, 0x03, 0x0b, 0x02, 0x07, 0x0d, 0x0a, 0x09, 0x05, 0x01, 0x08, 0x0f, 0x0e};
+
+typedef struct {
+    uint8_t in_lo[16];  /* i << 4 | k for the low 4 bits of the input */
+    uint8_t in_hi[16];  /* i << 4 | k for the high 4 bits of the input */
+    uint8_t out_io[16]; /* the output's share of (1/io)*(t^16 + N) */
+    uint8_t out_jo[16]; /* the output's share of (1/jo)*(t + N) */
+    uint8_t out_add;    /* the constant to add to the output */
+} AES_vperm_sbox;
+
+/* The S-box, and its inverse. */
+static const AES_vperm_sbox vperm_sbox[2] = {
+    {
+        {0x00, 0x10, 0x46, 0x56, 0xad, 0xbd, 0xeb, 0xfb, 0x9d, 0x8d, 0xdb, 0xcb, 0x30, 0x20, 0x76, 0x66},
+        {0x00, 0x57, 0x29, 0x7e, 0x07, 0x50, 0x2e, 0x79, 0xfe, 0xa9, 0xd7, 0x80, 0xf9, 0xae, 0xd0, 0x87},
+        {0x00, 0x4b, 0xb5, 0x2a, 0xa3, 0xc2, 0x9f, 0x89, 0x77, 0xfe, 0x5d, 0x16, 0x3c, 0x61, 0xe8, 0xd4},
+        {0x00, 0x54, 0x01, 0xb7, 0x11, 0xf2, 0xb6, 0xa6, 0xf3, 0x55, 0x44, 0x10, 0xa7, 0xe3, 0x45, 0xe2},
+        0x63
+    },
+    {
+        {0xbd, 0x61, 0xb9, 0x65, 0x19, 0xc5, 0x1d, 0xc1, 0xab, 0x77, 0xaf, 0x73, 0x0f, 0xd3, 0x0b, 0xd7},
+        {0x00, 0x7a, 0x8a, 0xf0, 0xef, 0x95, 0x65, 0x1f, 0x94, 0xee, 0x1e, 0x64, 0x7b, 0x01, 0xf1, 0x8b},
+        {0x00, 0x1e, 0xab, 0x8f, 0xb2, 0x23, 0x24, 0x3d, 0x88, 0xb5, 0x07, 0x19, 0x96, 0x91, 0xac, 0x3a},
+        {0x00, 0x1f, 0x4a, 0x3f, 0xee, 0xce, 0x75, 0xd1, 0x84, 0x55, 0xbb, 0xa4, 0x9b, 0x20, 0xf1, 0x6a},
+        0x00
+    }
+};
+
+/* Byte permutations: ShiftRows, InvShiftRows, and rotating every column up by 1 and 2 rows. */
+static const uint8_t vperm_shiftrows[16] = {0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12, 1, 6, 11};
+static const uint8_t vperm_invshiftrows[16] = {0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3};
+static const uint8_t vperm_rot1[16] = {1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12};
+static const uint8_t vperm_rot2[16] = {2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13};
+
+static VPERM_TARGET __m128i VpermLoad(const uint8_t* table) {
+    return _mm_loadu_si128((const __m128i*)table);
+}
+
+static VPERM_TARGET __m128i VpermSubBytes(__m128i x, int inv) {
+    const AES_vperm_sbox* sbox = &vperm_sbox[inv];
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    const __m128i tinv = VpermLoad(vperm_inv);
+    __m128i i, j, k, ak, iak, jak, io, jo;
+
+    /* Convert to the GF(2^4) representation, i in the high and k in the low 4 bits. */
+    k = _mm_and_si128(_mm_srli_epi32(x, 4), mask);
+    x = _mm_and_si128(x, mask);
+    x = _mm_xor_si128(_mm_shuffle_epi8(VpermLoad(sbox->in_lo), x), _mm_shuffle_epi8(VpermLoad(sbox->in_hi), k));
+    i = _mm_and_si128(_mm_srli_epi32(x, 4), mask);
+    k = _mm_and_si128(x, mask);
+    j = _mm_xor_si128(i, k);
+
+    /* Invert. */
+    ak = _mm_shuffle_epi8(VpermLoad(vperm_inva), k);
+    iak = _mm_xor_si128(_mm_shuffle_epi8(tinv, i), ak);
+    jak = _mm_xor_si128(_mm_shuffle_epi8(tinv, j), ak);
+    io = _mm_xor_si128(_mm_shuffle_epi8(tinv, iak), j);
+    jo = _mm_xor_si128(_mm_shuffle_epi8(tinv, jak), i);
+
+    /* Convert back. */
+    x = _mm_xor_si128(_mm_shuffle_epi8(VpermLoad(sbox->out_io), io), _mm_shuffle_epi8(VpermLoad(sbox->out_jo), jo));
+    return _mm_xor_si128(x, _mm_set1_epi8(sbox->out_add));
+}
+
+/* Multiply every byte of x by x, as polynomials over GF(2) mod x^8 + x^4 + x^3 + x + 1 */
+static VPERM_TARGET __m128i VpermMultX(__m128i x) {
+    __m128i top = _mm_cmplt_epi8(x, _mm_setzero_si128());
+    return _mm_xor_si128(_mm_add_epi8(x, x), _mm_and_si128(top, _mm_set1_epi8(0x1b)));
+}
+
+static VPERM_TARGET __m128i VpermMixColumns(__m128i x, int inv) {
+    /* See MixColumns: with rotations of the columns by 1 and 2 rows, and
+     * x2 = 2 * x, the output is x2 ^ rot1(x ^ x2) ^ rot2(x ^ rot1(x)). Its
+     * inverse is first mapping every column element s_i to
+     * s_i ^ 4 * (s_i ^ s_{i+2}) (the column times {04}x^2 + {05}), followed
+     * by MixColumns itself. */
+    const __m128i rot1 = VpermLoad(vperm_rot1), rot2 = VpermLoad(vperm_rot2);
+    __m128i x2;
+    if (inv) {
+        x = _mm_xor_si128(x, VpermMultX(VpermMultX(_mm_xor_si128(x, _mm_shuffle_epi8(x, rot2)))));
+    }
+    x2 = VpermMultX(x);
+    return _mm_xor_si128(_mm_xor_si128(x2, _mm_shuffle_epi8(_mm_xor_si128(x, x2), rot1)), _mm_shuffle_epi8(_mm_xor_si128(x, _mm_shuffle_epi8(x, rot1)), rot2));
+}
+
+/** Encrypt blocks consecutive blocks, one at a time, using round keys in byte order */
+static VPERM_TARGET size_t AES_encrypt_vperm(const AES_keys* keys, size_t blocks, unsigned char* cipher16, const unsigned char* plain16) {
+    unsigned char buf[15 * 16];
+    const unsigned char* rounds = ByteKeys(keys, buf);
+    int nrounds = keys->nrounds;
+    size_t left;
+    const __m128i shiftrows = VpermLoad(vperm_shiftrows);
+    for (left = blocks; left > 0; left--) {
+        __m128i s = _mm_xor_si128(_mm_loadu_si128((const __m128i*)plain16), VpermLoad(rounds));
+        int round;
+        for (round = 1; round < nrounds; round++) {
+            s = VpermSubBytes(_mm_shuffle_epi8(s, shiftrows), 0);
+            s = _mm_xor_si128(VpermMixColumns(s, 0), VpermLoad(rounds + 16 * round));
+        }
+        s = VpermSubBytes(_mm_shuffle_epi8(s, shiftrows), 0);
+        s = _mm_xor_si128(s, VpermLoad(rounds + 16 * nrounds));
+        _mm_storeu_si128((__m128i*)cipher16, s);
+        cipher16 += 16;
+        plain16 += 16;
+    }
+    return blocks;
+}
+
+/** Decrypt blocks consecutive blocks, one at a time, using round keys in byte order */
+static VPERM_TARGET size_t AES_decrypt_vperm(const AES_keys* keys, size_t blocks, unsigned char* plain16, const unsigned char* cipher16) {
+    unsigned char buf[15 * 16];
+    const unsigned char* rounds = ByteKeys(keys, buf);
+    int nrounds = keys->nrounds;
+    size_t left;
+    const __m128i invshiftrows = VpermLoad(vperm_invshiftrows);
+    for (left = blocks; left > 0; left--) {
+        __m128i s = _mm_xor_si128(_mm_loadu_si128((const __m128i*)cipher16), VpermLoad(rounds + 16 * nrounds));
+        int round;
+        for (round = nrounds - 1; round > 0; round--) {
+            s = VpermSubBytes(_mm_shuffle_epi8(s, invshiftrows), 1);
+            s = VpermMixColumns(_mm_xor_si128(s, VpermLoad(rounds + 16 * round)), 1);
+        }
+        s = VpermSubBytes(_mm_shuffle_epi8(s, invshiftrows), 1);
+        s = _mm_xor_si128(s, VpermLoad(rounds));
+        _mm_storeu_si128((__m128i*)plain16, s);
+        plain16 += 16;
+        cipher16 += 16;
+    }
+    return blocks;
+}
+
+/** Decrypt blocks consecutive blocks, one at a time, using inverse cipher round keys in byte order */
+static VPERM_TARGET size_t AES_decrypt_eq_vperm(const AES_keys* keys, size_t blocks, unsigned char* plain16, const unsigned char* cipher16) {
+    const unsigned char* rounds = keys->rounds_bytes;
+    int nrounds = keys->nrounds;
+    size_t left;
+    const __m128i invshiftrows = VpermLoad(vperm_invshiftrows);
+    for (left = blocks; left > 0; left--) {
+        __m128i s = _mm_xor_si128(_mm_loadu_si128((const __m128i*)cipher16), VpermLoad(rounds));
+        int round;
+        for (round = 1; round < nrounds; round++) {
+            s = VpermSubBytes(_mm_shuffle_epi8(s, invshiftrows), 1);
+            s = _mm_xor_si128(VpermMixColumns(s, 1), VpermLoad(rounds + 16 * round));
+        }
+        s = VpermSubBytes(_mm_shuffle_epi8(s, invshiftrows), 1);
+        s = _mm_xor_si128(s, VpermLoad(rounds + 16 * nrounds));
+        _mm_storeu_si128((__m128i*)plain16, s);
+        plain16 += 16;
+        cipher16 += 16;
+    }
+    return blocks;
+}
+
+static int HaveSSSE3(void) {
+    return !use_portable && __builtin_cpu_supports("ssse3");
+}
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+/* AES-NI, for x86 CPUs that have instructions for AES rounds, which are
+ * constant time by design. Compiled for AES-NI regardless of the compiler
+ * flags, and used for all blocks when the CPU supports it. */
+#define HAVE_AESNI 1
+#define AESNI_TARGET __attribute__((target("sse2,aes")))
+
+/** Apply the S-box to every byte of w */
+static AESNI_TARGET uint32_t AesniSubWord(uint32_t w) {
+    /* AESKEYGENASSIST puts SubWord of the second 32-bit word in the first. */
+    return _mm_cvtsi128_si32(_mm_aeskeygenassist_si128(_mm_set1_epi32(w), 0));
+}
+
+/** Expand the cipher key into the key schedule in byte order, as AES_setup does */
+static AESNI_TARGET void AES_setup_aesni(unsigned char* rounds_bytes, const uint8_t* key, int nkeywords, int nrounds) {
+    /* The key schedule as 32-bit words, with the first byte in the lowest bits. */
+    uint32_t words[60];
+    uint32_t rcon = 1;
     int i;
-    for (i = 0; i < 8; i++) {
-        s->slice[i] |= (uint16_t)(byte & 1) << (r * 4 + c);
-        byte >>= 1;
+
+    for (i = 0; i < nkeywords; i++) {
+        words[i] = key[4 * i] | (uint32_t)key[4 * i + 1] << 8 | (uint32_t)key[4 * i + 2] << 16 | (uint32_t)key[4 * i + 3] << 24;
+    }
+    for (i = nkeywords; i < 4 * (nrounds + 1); i++) {
+        uint32_t w = words[i - 1];
+        if (i % nkeywords == 0) {
+            w = AesniSubWord((w >> 8) | (w << 24)) ^ rcon;
+            rcon = (rcon << 1) ^ ((rcon >> 7) * 0x11b);
+        } else if (nkeywords > 6 && i % nkeywords == 4) {
+            w = AesniSubWord(w);
+        }
+        words[i] = words[i - nkeywords] ^ w;
+    }
+    for (i = 0; i < 4 * (nrounds + 1); i++) {
+        rounds_bytes[4 * i] = words[i];
+        rounds_bytes[4 * i + 1] = words[i] >> 8;
+        rounds_bytes[4 * i + 2] = words[i] >> 16;
+        rounds_bytes[4 * i + 3] = words[i] >> 24;
+    }
+}
+
+/** Encrypt blocks consecutive blocks, 4 at a time to overlap their latencies */
+static AESNI_TARGET size_t AES_encrypt_aesni(const AES_keys* keys, size_t blocks, unsigned char* cipher16, const unsigned char* plain16) {
+    unsigned char buf[15 * 16];
+    const unsigned char* rounds = ByteKeys(keys, buf);
+    int nrounds = keys->nrounds;
+    size_t left;
+    __m128i rk[15];
+    int round;
+    for (round = 0; round <= nrounds; round++) {
+        rk[round] = _mm_loadu_si128((const __m128i*)(rounds + 16 * round));
+    }
+    for (left = blocks; left >= 4; left -= 4) {
+        __m128i s0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)plain16), rk[0]);
+        __m128i s1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(plain16 + 16)), rk[0]);
+        __m128i s2 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(plain16 + 32)), rk[0]);
+        __m128i s3 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(plain16 + 48)), rk[0]);
+        for (round = 1; round < nrounds; round++) {
+            s0 = _mm_aesenc_si128(s0, rk[round]);
+            s1 = _mm_aesenc_si128(s1, rk[round]);
+            s2 = _mm_aesenc_si128(s2, rk[round]);
+            s3 = _mm_aesenc_si128(s3, rk[round]);
+        }
+        _mm_storeu_si128((__m128i*)cipher16, _mm_aesenclast_si128(s0, rk[nrounds]));
+        _mm_storeu_si128((__m128i*)(cipher16 + 16), _mm_aesenclast_si128(s1, rk[nrounds]));
+        _mm_storeu_si128((__m128i*)(cipher16 + 32), _mm_aesenclast_si128(s2, rk[nrounds]));
+        _mm_storeu_si128((__m128i*)(cipher16 + 48), _mm_aesenclast_si128(s3, rk[nrounds]));
+        cipher16 += 64;
+        plain16 += 64;
+    }
+    for (; left > 0; left--) {
+        __m128i s = _mm_xor_si128(_mm_loadu_si128((const __m128i*)plain16), rk[0]);
+        for (round = 1; round < nrounds; round++) {
+            s = _mm_aesenc_si128(s, rk[round]);
+        }
+        _mm_storeu_si128((__m128i*)cipher16, _mm_aesenclast_si128(s, rk[nrounds]));
+        cipher16 += 16;
+        plain16 += 16;
+    }
+    return blocks;
+}
+
+/** Decrypt blocks consecutive blocks, 4 at a time to overlap their latencies, using the inverse cipher round keys rk */
+static AESNI_TARGET void AesniDecrypt(const __m128i* rk, int nrounds, size_t blocks, unsigned char* plain16, const unsigned char* cipher16) {
+    size_t left;
+    int round;
+    for (left = blocks; left >= 4; left -= 4) {
+        __m128i s0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)cipher16), rk[0]);
+        __m128i s1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(cipher16 + 16)), rk[0]);
+        __m128i s2 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(cipher16 + 32)), rk[0]);
+        __m128i s3 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(cipher16 + 48)), rk[0]);
+        for (round = 1; round < nrounds; round++) {
+            s0 = _mm_aesdec_si128(s0, rk[round]);
+            s1 = _mm_aesdec_si128(s1, rk[round]);
+            s2 = _mm_aesdec_si128(s2, rk[round]);
+            s3 = _mm_aesdec_si128(s3, rk[round]);
+        }
+        _mm_storeu_si128((__m128i*)plain16, _mm_aesdeclast_si128(s0, rk[nrounds]));
+        _mm_storeu_si128((__m128i*)(plain16 + 16), _mm_aesdeclast_si128(s1, rk[nrounds]));
+        _mm_storeu_si128((__m128i*)(plain16 + 32), _mm_aesdeclast_si128(s2, rk[nrounds]));
+        _mm_storeu_si128((__m128i*)(plain16 + 48), _mm_aesdeclast_si128(s3, rk[nrounds]));
+        plain16 += 64;
+        cipher16 += 64;
+    }
+    for (; left > 0; left--) {
+        __m128i s = _mm_xor_si128(_mm_loadu_si128((const __m128i*)cipher16), rk[0]);
+        for (round = 1; round < nrounds; round++) {
+            s = _mm_aesdec_si128(s, rk[round]);
+        }
+        _mm_storeu_si128((__m128i*)plain16, _mm_aesdeclast_si128(s, rk[nrounds]));
+        plain16 += 16;
+        cipher16 += 16;
+    }
+}
+
+/** Decrypt blocks consecutive blocks using AES-NI */
+static AESNI_TARGET size_t AES_decrypt_aesni(const AES_keys* keys, size_t blocks, unsigned char* plain16, const unsigned char* cipher16) {
+    /* AESDEC implements the equivalent inverse cipher, which needs the round
+     * keys in reverse order, and InvMixColumns applied to all but the outer two. */
+    unsigned char buf[15 * 16];
+    const unsigned char* rounds = ByteKeys(keys, buf);
+    int nrounds = keys->nrounds;
+    __m128i rk[15];
+    int round;
+    rk[0] = _mm_loadu_si128((const __m128i*)(rounds + 16 * nrounds));
+    for (round = 1; round < nrounds; round++) {
+        rk[round] = _mm_aesimc_si128(_mm_loadu_si128((const __m128i*)(rounds + 16 * (nrounds - round))));
+    }
+    rk[nrounds] = _mm_loadu_si128((const __m128i*)rounds);
+    AesniDecrypt(rk, nrounds, blocks, plain16, cipher16);
+    return blocks;
+}
+
+/** Decrypt blocks consecutive blocks using AES-NI, with inverse cipher round keys in byte order */
+static AESNI_TARGET size_t AES_decrypt_eq_aesni(const AES_keys* keys, size_t blocks, unsigned char* plain16, const unsigned char* cipher16) {
+    const unsigned char* rounds = keys->rounds_bytes;
+    int nrounds = keys->nrounds;
+    __m128i rk[15];
+    int round;
+    for (round = 0; round <= nrounds; round++) {
+        rk[round] = _mm_loadu_si128((const __m128i*)(rounds + 16 * round));
+    }
+    AesniDecrypt(rk, nrounds, blocks, plain16, cipher16);
+    return blocks;
+}
+
+/* Whether the CPU has AES-NI: -1 until the first call checks. */
+static int aesni_supported = -1;
+
+static int HaveAESNI(void) {
+    int supported = __atomic_load_n(&aesni_supported, __ATOMIC_RELAXED);
+    if (supported < 0) {
+        unsigned int eax, ebx, ecx, edx;
+        supported = __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_AES) && (edx & bit_SSE2);
+        __atomic_store_n(&aesni_supported, supported, __ATOMIC_RELAXED);
+    }
+    return !use_portable && supported;
+}
+#endif
+
+#ifdef CTAES_VECTOR_BYTES
+/* The same for CTAES_VECTOR_BYTES / 2 blocks at once, in slices that are generic
+ * GCC/Clang vectors of CTAES_VECTOR_BYTES bytes. This lets the compiler map the
+ * round functions onto whatever vector unit the build targets (e.g. NEON, or
+ * AVX-512 with -DCTAES_VECTOR_BYTES=64 -mavx512f). As it is explicitly asked
+ * for, it is preferred over the other multi-block code. */
+#if CTAES_VECTOR_BYTES != 16 && CTAES_VECTOR_BYTES != 32 && CTAES_VECTOR_BYTES != 64
+#error "CTAES_VECTOR_BYTES must be 16, 32 or 64"
+#endif
+#define VECTOR_BLOCKS (CTAES_VECTOR_BYTES / 2)
+
+typedef uint64_t AES_slice_xv __attribute__((vector_size(CTAES_VECTOR_BYTES)));
+
+typedef struct {
+    AES_slice_xv slice[8];
+} AES_state_xv;
+
+#define SLICE_T AES_slice_xv
+#define SLICE_ELEM_T uint64_t
+#define SLICE_ELEMS (CTAES_VECTOR_BYTES / 8)
+#define SLICE_ELEM(x,e) (x)[e]
+#define SLICE_LANES 4
+#define STATE_T AES_state_xv
+#define BS(name) name##_xv
+#include "ctaes_bitslice_impl.h"
+#endif
+
+/* Key schedules are computed for several keys at once, laid side by side:
+ * the slices of key j are bits 16 * j to 16 * j + 15 of the wider slices below,
+ * so that a single SubBytes call transforms a column of every key. */
+#ifdef HAVE_X4
+typedef AES_state_x4 AES_key_states;
+typedef uint64_t AES_key_slice;
+#define KEYS_AT_ONCE 4
+#define SubBytes_keys SubBytes_fwd_x4
+#define Ortho_keys Ortho_x4
+#else
+typedef AES_state_x2 AES_key_states;
+typedef uint32_t AES_key_slice;
+#define KEYS_AT_ONCE 2
+#define SubBytes_keys SubBytes_fwd_x2
+#define Ortho_keys Ortho_x2
+#endif
+
+/** Replicate the 16-bit x over all keys in a slice */
+#define REPEAT16(x) (((AES_key_slice)-1 / 0xFFFF) * (x))
+
+/** The order of the 16-bit words of a block in LoadBytes and SaveBytes */
+static const int key_word_unit[8] = {0, 2, 4, 6, 1, 3, 5, 7};
+
+/** Move the bits of every key from their index after Ortho to their index in the state (or back) */
+static void FixIndexKeys(AES_key_states* s) {
+    int b;
+    for (b = 0; b < 8; b++) {
+        AES_key_slice t = (s->slice[b] ^ (s->slice[b] >> 4)) & REPEAT16(0x00F0);
+        s->slice[b] ^= t ^ (t << 4);
+    }
+}
+
+/** LoadBytes for nkeys keys at once, the one for key j from data + j * stride
+ *
+ *  Ortho only moves bits within bytes, so the wider slices' Ortho does this
+ *  for all keys side by side.
+ */
+static void LoadKeys(AES_key_states* s, const unsigned char* data, size_t stride, int nkeys) {
+    int j, w;
+    for (w = 0; w < 8; w++) {
+        s->slice[w] = 0;
+        for (j = 0; j < nkeys; j++) {
+            const unsigned char* p = data + j * stride + 2 * key_word_unit[w];
+            s->slice[w] |= (AES_key_slice)(p[0] | (p[1] << 8)) << (16 * j);
+        }
+    }
+    Ortho_keys(s);
+    FixIndexKeys(s);
+}
+
+/** Store the nrounds + 1 round keys in rounds in byte order, as the vector
+ *  permute and AES-NI code use them, at wide_rounds (16 * (nrounds + 1) bytes).
+ */
+#if defined(__SSE2__) && defined(__GNUC__)
+static void LoadByteKeys(void* wide_rounds, const AES_state* rounds, int nrounds) {
+    /* PMOVMSKB collects the top bit of every byte. With the low bytes of the 8
+     * slices followed by their high bytes, shifted so that bit q is on top, it
+     * gives the bytes at positions q and q + 8 of the state. Positions run
+     * along the rows, while the bytes of a block run down the columns, so
+     * interleaving the results for q < 4 with those for q >= 4 puts every
+     * byte in its place. */
+    unsigned char* bytes = wide_rounds;
+    int i;
+    for (i = 0; i <= nrounds; i++) {
+        __m128i s = _mm_loadu_si128((const __m128i*)&rounds[i]);
+        __m128i v = _mm_packus_epi16(_mm_and_si128(s, _mm_set1_epi16(0xFF)), _mm_srli_epi16(s, 8));
+        __m128i m = _mm_setzero_si128();
+        m = _mm_insert_epi16(m, _mm_movemask_epi8(_mm_slli_epi64(v, 7)), 0);
+        m = _mm_insert_epi16(m, _mm_movemask_epi8(_mm_slli_epi64(v, 6)), 1);
+        m = _mm_insert_epi16(m, _mm_movemask_epi8(_mm_slli_epi64(v, 5)), 2);
+        m = _mm_insert_epi16(m, _mm_movemask_epi8(_mm_slli_epi64(v, 4)), 3);
+        m = _mm_insert_epi16(m, _mm_movemask_epi8(_mm_slli_epi64(v, 3)), 4);
+        m = _mm_insert_epi16(m, _mm_movemask_epi8(_mm_slli_epi64(v, 2)), 5);
+        m = _mm_insert_epi16(m, _mm_movemask_epi8(_mm_slli_epi64(v, 1)), 6);
+        m = _mm_insert_epi16(m, _mm_movemask_epi8(v), 7);
+        _mm_storeu_si128((__m128i*)(bytes + 16 * i), _mm_unpacklo_epi8(m, _mm_srli_si128(m, 8)));
+    }
+}
+#else
+/** SaveBytes for nkeys keys at once, the one for key j to data + j * stride */
+static void SaveKeys(unsigned char* data, size_t stride, const AES_key_states* s, int nkeys) {
+    AES_key_states t = *s;
+    int j, w;
+    FixIndexKeys(&t);
+    Ortho_keys(&t);
+    for (w = 0; w < 8; w++) {
+        for (j = 0; j < nkeys; j++) {
+            unsigned char* p = data + j * stride + 2 * key_word_unit[w];
+            p[0] = t.slice[w] >> (16 * j);
+            p[1] = t.slice[w] >> (16 * j + 8);
+        }
+    }
+}
+
+static void LoadByteKeys(void* wide_rounds, const AES_state* rounds, int nrounds) {
+    /* SaveKeys transposes KEYS_AT_ONCE of them at once, laid side by side as
+     * the keys in AES_setup_keys are. */
+    unsigned char* bytes = wide_rounds;
+    int i, j, b;
+    for (i = 0; i <= nrounds; i += KEYS_AT_ONCE) {
+        int n = nrounds + 1 - i < KEYS_AT_ONCE ? nrounds + 1 - i : KEYS_AT_ONCE;
+        AES_key_states s;
+        for (b = 0; b < 8; b++) {
+            s.slice[b] = 0;
+            for (j = 0; j < n; j++) {
+                s.slice[b] |= (AES_key_slice)rounds[i + j].slice[b] << (16 * j);
+            }
+        }
+        SaveKeys(bytes + 16 * i, 16, &s, n);
+    }
+}
+#endif
+
+/** Return the round keys of keys in byte order: stored with them, prepared in keys->wide_rounds, or else converted into buf */
+static const unsigned char* ByteKeys(const AES_keys* keys, unsigned char* buf) {
+    if (keys->rounds_bytes) {
+        return keys->rounds_bytes;
+    }
+    if (keys->wide_rounds && keys->wide_load == LoadByteKeys) {
+        return keys->wide_rounds;
+    }
+    LoadByteKeys(buf, keys->rounds, keys->nrounds);
+    return buf;
+}
+
+/** column_0(s) = column_c(a) */
+static void GetOneColumn(AES_key_states* s, const AES_key_states* a, int c) {
+    int b;
+    for (b = 0; b < 8; b++) {
+        s->slice[b] = (a->slice[b] >> c) & REPEAT16(0x1111);
+    }
+}
+
+/** column_c1(r) |= (column_0(s) ^= column_c2(a)) */
+static void KeySetupColumnMix(AES_key_states* s, AES_key_states* r, const AES_key_states* a, int c1, int c2) {
+    int b;
+    for (b = 0; b < 8; b++) {
+        r->slice[b] |= ((s->slice[b] ^= ((a->slice[b] >> c2) & REPEAT16(0x1111))) & REPEAT16(0x1111)) << c1;
+    }
+}
+
+/** Rotate the rows in s one position upwards, and xor in r */
+static void KeySetupTransform(AES_key_states* s, const AES_key_states* r) {
+    int b;
+    for (b = 0; b < 8; b++) {
+        s->slice[b] = (((s->slice[b] >> 4) & REPEAT16(0x0FFF)) | ((s->slice[b] << 12) & REPEAT16(0xF000))) ^ r->slice[b];
+    }
+}
+
+/* Multiply the cells in s by x, as polynomials over GF(2) mod x^8 + x^4 + x^3 + x + 1 */
+static void MultX(AES_key_states* s) {
+    AES_key_slice top = s->slice[7];
+    s->slice[7] = s->slice[6];
+    s->slice[6] = s->slice[5];
+    s->slice[5] = s->slice[4];
+    s->slice[4] = s->slice[3] ^ top;
+    s->slice[3] = s->slice[2] ^ top;
+    s->slice[2] = s->slice[1];
+    s->slice[1] = s->slice[0] ^ top;
+    s->slice[0] = top;
+}
+
+/** Encrypt blocks consecutive blocks one at a time, in 16-bit slices */
+static size_t AES_encrypt_scalar(const AES_keys* keys, size_t blocks, unsigned char* cipher16, const unsigned char* plain16) {
+    size_t i;
+    for (i = 0; i < blocks; i++) {
+        AES_encrypt(keys->rounds, keys->nrounds, cipher16 + 16 * i, plain16 + 16 * i);
+    }
+    return blocks;
+}
+
+/** Decrypt blocks consecutive blocks one at a time, in 16-bit slices */
+static size_t AES_decrypt_scalar(const AES_keys* keys, size_t blocks, unsigned char* plain16, const unsigned char* cipher16) {
+    size_t i;
+    for (i = 0; i < blocks; i++) {
+        AES_decrypt(keys->rounds, keys->nrounds, plain16 + 16 * i, cipher16 + 16 * i);
+    }
+    return blocks;
+}
+
+/* An implementation of encryption and decryption for all key sizes. */
+typedef struct {
+    const char* name;
+    /* Only multiples of this many blocks are processed. */
+    size_t group;
+    /* Whether it can run on this CPU (NULL if always), and is not disabled by AES_set_portable. */
+    int (*supported)(void);
+    /* Process as many of blocks consecutive blocks as possible, returning how many that is. */
+    size_t (*encrypt)(const AES_keys* keys, size_t blocks, unsigned char* cipher16, const unsigned char* plain16);
+    size_t (*decrypt)(const AES_keys* keys, size_t blocks, unsigned char* plain16, const unsigned char* cipher16);
+    /* The same as decrypt, for the keys of a decryption context. Bit sliced
+     * backends only use the bit sliced keys, which are the normal ones there. */
+    size_t (*decrypt_eq)(const AES_keys* keys, size_t blocks, unsigned char* plain16, const unsigned char* cipher16);
+    /* Process as many of blocks separate blocks as possible, block i with
+     * keys[i], returning how many that is. NULL for backends that process
+     * single blocks, which are then passed to encrypt or decrypt one by one. */
+    size_t (*encrypt_lanes)(const AES_keys* keys, size_t blocks, unsigned char* const* cipher16, const unsigned char* const* plain16);
+    size_t (*decrypt_lanes)(const AES_keys* keys, size_t blocks, unsigned char* const* plain16, const unsigned char* const* cipher16);
+    /* Prepare the round keys in rounds, in group * 16 bytes per round, so
+     * that encrypt and decrypt can use them as wide_rounds, or NULL. */
+    void (*load_keys)(void* wide_rounds, const AES_state* rounds, int nrounds);
+    /* CTR encrypt whole runs of 256 counter blocks from after their first
+     * round (see AESCTR_crypt_runs), or NULL. */
+    void (*encrypt_runs)(const AES_keys* keys, const unsigned char* cols, const unsigned char* bases, size_t runs, unsigned char* out16, const unsigned char* in16);
+} AES_backend;
+
+/* All backends, in order of preference. Every call uses the first supported
+ * backend whose group fits in the remaining blocks, so the code for a single
+ * block at the end of the list processes whatever is left. */
+static const AES_backend backends[] = {
+#ifdef HAVE_AESNI
+    {"aesni", 1, HaveAESNI, AES_encrypt_aesni, AES_decrypt_aesni, AES_decrypt_eq_aesni, NULL, NULL, LoadByteKeys, NULL},
+#endif
+#ifdef VECTOR_BLOCKS
+    {"vector", VECTOR_BLOCKS, NULL, AES_encrypt_groups_xv, AES_decrypt_groups_xv, AES_decrypt_groups_xv, AES_encrypt_lanes_xv, AES_decrypt_lanes_xv, LoadGroupKeys_xv, AES_encrypt_runs_xv},
+#endif
+#ifdef HAVE_X16
+    {"avx2x16", 16, HaveAVX2, AES_encrypt_groups_x16, AES_decrypt_groups_x16, AES_decrypt_groups_x16, AES_encrypt_lanes_x16, AES_decrypt_lanes_x16, LoadGroupKeys_x16, AES_encrypt_runs_x16},
+#endif
+#ifdef HAVE_X8
+    {"sse2x8", 8, NULL, AES_encrypt_groups_x8, AES_decrypt_groups_x8, AES_decrypt_groups_x8, AES_encrypt_lanes_x8, AES_decrypt_lanes_x8, LoadGroupKeys_x8, AES_encrypt_runs_x8},
+#endif
+#ifdef HAVE_X4
+    {"bitslice64", 4, NULL, AES_encrypt_groups_x4, AES_decrypt_groups_x4, AES_decrypt_groups_x4, AES_encrypt_lanes_x4, AES_decrypt_lanes_x4, LoadGroupKeys_x4, AES_encrypt_runs_x4},
+#endif
+#ifdef HAVE_VPERM
+    {"vperm", 1, HaveSSSE3, AES_encrypt_vperm, AES_decrypt_vperm, AES_decrypt_eq_vperm, NULL, NULL, LoadByteKeys, NULL},
+#endif
+    {"fixslice32", 2, NULL, AES_encrypt_groups_x2, AES_decrypt_groups_x2, AES_decrypt_groups_x2, AES_encrypt_lanes_x2, AES_decrypt_lanes_x2, LoadGroupKeys_x2, AES_encrypt_runs_x2},
+    {"scalar16", 1, NULL, AES_encrypt_scalar, AES_decrypt_scalar, AES_decrypt_scalar, NULL, NULL, NULL, NULL}
+};
+
+#define NUM_BACKENDS (sizeof(backends) / sizeof(backends[0]))
+
+/* Whether AES_set_backend was called, overriding the CTAES_BACKEND environment
+ * variable, and the backend it chose (NULL for automatic). */
+static int backend_set = 0;
+static const AES_backend* forced_backend = NULL;
+
+static const AES_backend* FindBackend(const char* name) {
+    size_t i;
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        if (strcmp(backends[i].name, name) == 0 && (backends[i].supported == NULL || backends[i].supported())) {
+            return &backends[i];
+        }
+    }
+    return NULL;
+}
+
+/** Whether backend can run on this CPU, and is not disabled by AES_set_portable */
+static int BackendSupported(const AES_backend* backend) {
+    return backend->supported == NULL || backend->supported();
+}
+
+/* A backend to use, and the fewest blocks a call must have left to use it. */
+typedef struct {
+    const AES_backend* backend;
+    size_t min_blocks;
+} AES_active;
+
+/* The list of backends from AES_autotune or AES_autotune_load (if tuned), in
+ * the format of ResolveBackends. */
+static int tuned = 0;
+static AES_active tuned_backends[NUM_BACKENDS + 1];
+
+static int LoadTuning(const char* path);
+static void Autotune(void);
+static int SaveTuning(const char* path);
+
+/** Fill active with the backends to use, in order of preference, followed by an entry with backend NULL.
+ *
+ *  The last backend before that always processes single blocks, with
+ *  min_blocks 1. When tune is nonzero, the CTAES_TUNING environment variable
+ *  may load (or compute and save) a tuning, and any tuning is used. When it
+ *  is zero, the tuning is not even read, as another thread may be writing it.
+ */
+static void ResolveBackends(AES_active* active, int tune) {
+    const AES_backend* forced = forced_backend;
+    size_t i, n = 0;
+    if (!backend_set) {
+        const char* name = getenv("CTAES_BACKEND");
+        forced = name ? FindBackend(name) : NULL;
+    } else if (forced && !BackendSupported(forced)) {
+        /* Disabled by AES_set_portable since. */
+        forced = NULL;
+    }
+    if (forced) {
+        /* Only use the forced backend, and the last one for leftover blocks. */
+        active[n].backend = forced;
+        active[n++].min_blocks = forced->group;
+    } else {
+        const char* path = getenv("CTAES_TUNING");
+        if (tune && !tuned && path && !LoadTuning(path)) {
+            Autotune();
+            SaveTuning(path);
+        }
+        if (tune && tuned) {
+            for (i = 0; tuned_backends[i].backend; i++) {
+                if (BackendSupported(tuned_backends[i].backend)) {
+                    active[n++] = tuned_backends[i];
+                }
+            }
+        } else {
+            for (i = 0; i < NUM_BACKENDS; i++) {
+                if (BackendSupported(&backends[i])) {
+                    active[n].backend = &backends[i];
+                    active[n++].min_blocks = backends[i].group;
+                }
+            }
+        }
+    }
+    if (n == 0 || active[n - 1].min_blocks != 1) {
+        active[n].backend = &backends[NUM_BACKENDS - 1];
+        active[n++].min_blocks = 1;
+    }
+    active[n].backend = NULL;
+}
+
+/* The result of ResolveBackends, valid once active_state is 2. */
+static AES_active active_backends[NUM_BACKENDS + 2];
+/* 0 if active_backends is not computed yet, 1 while it is being computed, 2 once it is. */
+static int active_state = 0;
+
+/** Return the backends to use, as filled in by ResolveBackends.
+ *
+ *  They are determined once and cached; callers that find another thread
+ *  doing so at the same time use local, an array of NUM_BACKENDS + 2
+ *  entries, instead of waiting (without any tuning from CTAES_TUNING).
+ */
+static const AES_active* ActiveBackends(AES_active* local) {
+#ifdef __GNUC__
+    int expected = 0;
+    if (__atomic_load_n(&active_state, __ATOMIC_ACQUIRE) == 2) {
+        return active_backends;
+    }
+    if (__atomic_compare_exchange_n(&active_state, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        ResolveBackends(active_backends, 1);
+        __atomic_store_n(&active_state, 2, __ATOMIC_RELEASE);
+        return active_backends;
+    }
+#endif
+    ResolveBackends(local, 0);
+    return local;
+}
+
+/** Encrypt blocks consecutive blocks with keys, using the preferred backend for as many as possible */
+static void AES_encrypt_keys(const AES_keys* keys, size_t blocks, unsigned char* cipher16, const unsigned char* plain16) {
+    AES_active local[NUM_BACKENDS + 2];
+    const AES_active* active = ActiveBackends(local);
+    while (blocks > 0) {
+        size_t done;
+        while (active->min_blocks > blocks) {
+            active++;
+        }
+        done = active->backend->encrypt(keys, blocks, cipher16, plain16);
+        cipher16 += done * 16;
+        plain16 += done * 16;
+        blocks -= done;
+    }
+}
+
+/** Decrypt blocks consecutive blocks with keys, using the preferred backend for as many as possible.
+ *  If eq is nonzero, keys->rounds_bytes holds the inverse cipher round keys of a decryption context.
+ */
+static void AES_decrypt_keys(const AES_keys* keys, int eq, size_t blocks, unsigned char* plain16, const unsigned char* cipher16) {
+    AES_active local[NUM_BACKENDS + 2];
+    const AES_active* active = ActiveBackends(local);
+    while (blocks > 0) {
+        size_t done;
+        while (active->min_blocks > blocks) {
+            active++;
+        }
+        done = (eq ? active->backend->decrypt_eq : active->backend->decrypt)(keys, blocks, plain16, cipher16);
+        plain16 += done * 16;
+        cipher16 += done * 16;
+        blocks -= done;
+    }
+}
+
+/** Encrypt blocks consecutive blocks, using the preferred backend for as many as possible */
+static void AES_encrypt_blocks(const AES_state* rounds, const unsigned char* rounds_bytes, int nrounds, size_t blocks, unsigned char* cipher16, const unsigned char* plain16) {
+    AES_keys keys;
+    InitKeys(&keys, rounds, rounds_bytes, nrounds);
+    AES_encrypt_keys(&keys, blocks, cipher16, plain16);
+}
+
+/** Decrypt blocks consecutive blocks, using the preferred backend for as many as possible.
+ *  If eq is nonzero, rounds_bytes holds the inverse cipher round keys of a decryption context.
+ */
+static void AES_decrypt_blocks(const AES_state* rounds, const unsigned char* rounds_bytes, int eq, int nrounds, size_t blocks, unsigned char* plain16, const unsigned char* cipher16) {
+    AES_keys keys;
+    InitKeys(&keys, rounds, rounds_bytes, nrounds);
+    AES_decrypt_keys(&keys, eq, blocks, plain16, cipher16);
+}
+
+/* The number of blocks with separate keys passed to AES_encrypt_lanes and
+ * AES_decrypt_lanes at once, a multiple of every backend's group. */
+#define LANES_CHUNK 64
+
+/** Skip to the first single block backend in active, unless that is the
+ *  portable one. Loading the separate round keys of every block into the lanes
+ *  costs about as much as encrypting them, so the vector permute and AES-NI
+ *  code is faster for blocks with different keys than any bit sliced code.
+ */
+static const AES_active* LanesBackends(const AES_active* active) {
+    const AES_active* single = active;
+    while (single->backend->encrypt_lanes) {
+        single++;
     }
+    return single->backend == &backends[NUM_BACKENDS - 1] ? active : single;
+}
+
+/** Encrypt the blocks plain16[i] into cipher16[i] with keys[i], for every i < blocks,
+ *  using the preferred backend for as many as possible.
+ */
+static void AES_encrypt_lanes(const AES_keys* keys, size_t blocks, unsigned char* const* cipher16, const unsigned char* const* plain16) {
+    AES_active local[NUM_BACKENDS + 2];
+    const AES_active* active = LanesBackends(ActiveBackends(local));
+    while (blocks > 0) {
+        size_t done;
+        while (active->min_blocks > blocks) {
+            active++;
+        }
+        if (active->backend->encrypt_lanes) {
+            done = active->backend->encrypt_lanes(keys, blocks, cipher16, plain16);
+        } else {
+            for (done = 0; done < blocks; done++) {
+                active->backend->encrypt(&keys[done], 1, cipher16[done], plain16[done]);
+            }
+        }
+        keys += done;
+        cipher16 += done;
+        plain16 += done;
+        blocks -= done;
+    }
+}
+
+/** Decrypt the blocks cipher16[i] into plain16[i] with keys[i], for every i < blocks,
+ *  using the preferred backend for as many as possible.
+ */
+static void AES_decrypt_lanes(const AES_keys* keys, size_t blocks, unsigned char* const* plain16, const unsigned char* const* cipher16) {
+    AES_active local[NUM_BACKENDS + 2];
+    const AES_active* active = LanesBackends(ActiveBackends(local));
+    while (blocks > 0) {
+        size_t done;
+        while (active->min_blocks > blocks) {
+            active++;
+        }
+        if (active->backend->decrypt_lanes) {
+            done = active->backend->decrypt_lanes(keys, blocks, plain16, cipher16);
+        } else {
+            for (done = 0; done < blocks; done++) {
+                active->backend->decrypt(&keys[done], 1, plain16[done], cipher16[done]);
+            }
+        }
+        keys += done;
+        plain16 += done;
+        cipher16 += done;
+        blocks -= done;
+    }
+}
+
+/* The largest number of blocks timed by Autotune, and considered for thresholds. */
+#define TUNE_BLOCKS 256
+
+/** Return the CPU time in seconds that backend takes to encrypt blocks blocks */
+static double TimeBackend(const AES_backend* backend, const AES_keys* keys, size_t blocks, unsigned char* buf) {
+    double best = 0.0;
+    int rep;
+    /* Repeat calls in growing batches for at least a millisecond, and take the best of 3 such runs. */
+    for (rep = 0; rep < 3; rep++) {
+        clock_t start = clock(), elapsed;
+        long calls = 0, batch = 1, i;
+        do {
+            for (i = 0; i < batch; i++) {
+                backend->encrypt(keys, blocks, buf, buf);
+            }
+            calls += batch;
+            batch *= 2;
+            elapsed = clock() - start;
+        } while (elapsed < CLOCKS_PER_SEC / 1000);
+        if (rep == 0 || (double)elapsed / calls < best) {
+            best = (double)elapsed / calls;
+        }
+    }
+    return best / CLOCKS_PER_SEC;
+}
+
+/* The measurements for one backend: the cost of a call as overhead + blocks * per_block. */
+typedef struct {
+    double overhead;
+    double per_block;
+} AES_timing;
+
+/** The modeled time for the backends in active (with timings in timing) to process blocks blocks */
+static double ModelTime(const AES_active* active, const AES_timing* timing, size_t blocks) {
+    double total = 0.0;
+    size_t i = 0;
+    while (blocks > 0) {
+        size_t done;
+        while (active[i].min_blocks > blocks) {
+            i++;
+        }
+        done = blocks - blocks % active[i].backend->group;
+        total += timing[active[i].backend - backends].overhead + done * timing[active[i].backend - backends].per_block;
+        blocks -= done;
+    }
+    return total;
+}
+
+/** Derive from which number of blocks on each supported backend is worth using, given their timings. */
+static void TuneBackends(const AES_timing* timing) {
+    /* The tuned list being built, from the end (fewest blocks) to the start. */
+    AES_active result[NUM_BACKENDS + 1];
+    size_t nresult = 0, n = 0, i, first = NUM_BACKENDS;
+    int group;
+
+    /* The start of the list is the fastest one for a single block. */
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        if (backends[i].group == 1 && BackendSupported(&backends[i]) &&
+            (first == NUM_BACKENDS || timing[i].overhead + timing[i].per_block < timing[first].overhead + timing[first].per_block)) {
+            first = i;
+        }
+    }
+    result[NUM_BACKENDS].backend = &backends[first];
+    result[NUM_BACKENDS].min_blocks = 1;
+    nresult = 1;
+
+    /* Add the others, narrowest groups first, in front of the list from the
+     * smallest number of blocks on where doing so is faster. */
+    for (group = 1; group <= TUNE_BLOCKS; group++) {
+        for (i = 0; i < NUM_BACKENDS; i++) {
+            size_t blocks;
+            AES_active* list = &result[NUM_BACKENDS + 1 - nresult];
+            if (backends[i].group != (size_t)group || i == first || !BackendSupported(&backends[i])) {
+                continue;
+            }
+            list[-1].backend = &backends[i];
+            for (blocks = group; blocks <= TUNE_BLOCKS; blocks++) {
+                list[-1].min_blocks = blocks;
+                if (ModelTime(list - 1, timing, blocks) < ModelTime(list, timing, blocks)) {
+                    nresult++;
+                    break;
+                }
+            }
+        }
+    }
+
+    /* A backend that was added with a threshold no lower than one added later
+     * (in front of it) is never reached, as calls only get to it with fewer
+     * blocks than that. Leave such backends out, so the thresholds decrease
+     * as LoadTuning expects. */
+    for (i = NUM_BACKENDS + 1 - nresult; i <= NUM_BACKENDS; i++) {
+        if (n == 0 || i == NUM_BACKENDS || result[i].min_blocks < tuned_backends[n - 1].min_blocks) {
+            tuned_backends[n++] = result[i];
+        }
+    }
+    tuned_backends[n].backend = NULL;
+    tuned = 1;
+}
+
+/** Time every supported backend, and derive from which number of blocks on each one is worth using. */
+static void Autotune(void) {
+    /* The code is constant time, so the contents of the keys and data don't matter. */
+    static const AES_state zero_rounds[15];
+    unsigned char buf[TUNE_BLOCKS * 16];
+    AES_timing timing[NUM_BACKENDS];
+    size_t i;
+    AES_keys keys;
+    InitKeys(&keys, zero_rounds, NULL, 10);
+    memset(buf, 0, sizeof(buf));
+    if (clock() == (clock_t)-1) {
+        return;
+    }
+
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        if (BackendSupported(&backends[i])) {
+            /* Time one group, and as many groups as fit in TUNE_BLOCKS. */
+            size_t small = backends[i].group, large = TUNE_BLOCKS - TUNE_BLOCKS % small;
+            double t_small = TimeBackend(&backends[i], &keys, small, buf);
+            double t_large = TimeBackend(&backends[i], &keys, large, buf);
+            timing[i].per_block = (t_large - t_small) / (large - small);
+            if (timing[i].per_block < 0.0) {
+                timing[i].per_block = 0.0;
+            }
+            timing[i].overhead = t_small - small * timing[i].per_block;
+            if (timing[i].overhead < 0.0) {
+                timing[i].overhead = 0.0;
+            }
+        }
+    }
+    TuneBackends(timing);
+}
+
+/** Load a tuning saved by SaveTuning, returning whether that succeeded */
+static int LoadTuning(const char* path) {
+    AES_active list[NUM_BACKENDS + 1];
+    size_t n = 0;
+    char name[32];
+    unsigned long min_blocks;
+    int version, ok = 0, bad = 0;
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return 0;
+    }
+    if (fscanf(file, "ctaes-tuning %d", &version) == 1 && version == 1) {
+        while (!bad && fscanf(file, "%31s %lu", name, &min_blocks) == 2) {
+            const AES_backend* backend = FindBackend(name);
+            bad = n == NUM_BACKENDS || backend == NULL || min_blocks < backend->group || (n > 0 && min_blocks > list[n - 1].min_blocks);
+            list[n].backend = backend;
+            list[n++].min_blocks = min_blocks;
+        }
+        /* All lines must be valid, and the list must end with single blocks. */
+        ok = !bad && feof(file) && n > 0 && list[n - 1].min_blocks == 1;
+    }
+    fclose(file);
+    if (ok) {
+        memcpy(tuned_backends, list, n * sizeof(list[0]));
+        tuned_backends[n].backend = NULL;
+        tuned = 1;
+    }
+    return ok;
+}
+
+/** Save the current tuning to path, returning whether that succeeded */
+static int SaveTuning(const char* path) {
+    size_t i;
+    int ok;
+    FILE* file;
+    if (!tuned || (file = fopen(path, "w")) == NULL) {
+        return 0;
+    }
+    ok = fprintf(file, "ctaes-tuning 1\n") > 0;
+    for (i = 0; tuned_backends[i].backend; i++) {
+        ok &= fprintf(file, "%s %lu\n", tuned_backends[i].backend->name, (unsigned long)tuned_backends[i].min_blocks) > 0;
+    }
+    ok &= fclose(file) == 0;
+    return ok;
+}
+
+/** Expand the cipher keys of up to KEYS_AT_ONCE keys into their key schedules.
+ *
+ *  keys must be a pointer to nkeys * 4 * nkeywords bytes. The schedule of
+ *  key j goes to rounds advanced by j * stride bytes.
+ */
+static void AES_setup_keys(AES_state* rounds, size_t stride, const uint8_t* keys, int nkeys, int nkeywords, int nrounds)
+{
+    int i, j, b;
+
+    /* The round keys of all keys, side by side */
+    AES_key_states wide[15];
+    /* The one-byte round constant */
+    AES_key_states rcon = {{REPEAT16(1),0,0,0,0,0,0,0}};
+    /* The number of the word being generated, modulo nkeywords */
+    int pos = 0;
+    /* The column representing the word currently being processed */
+    AES_key_states column;
+
+    memset(wide, 0, sizeof(wide[0]) * (nrounds + 1));
+
+    /* The first nkeywords round columns are just taken from the keys directly. */
+    {
+        unsigned char padded[KEYS_AT_ONCE][32];
+        memset(padded, 0, sizeof(padded));
+        for (j = 0; j < nkeys; j++) {
+            memcpy(padded[j], keys + 4 * nkeywords * j, nkeywords * 4);
+        }
+        for (i = 0; i < (nkeywords + 3) >> 2; i++) {
+            LoadKeys(&wide[i], padded[0] + 16 * i, 32, nkeys);
+        }
+    }
+
+    GetOneColumn(&column, &wide[(nkeywords - 1) >> 2], (nkeywords - 1) & 3);
+
+    for (i = nkeywords; i < 4 * (nrounds + 1); i++) {
+        /* Transform column */
+        if (pos == 0) {
+            SubBytes_keys(&column);
+            KeySetupTransform(&column, &rcon);
+            MultX(&rcon);
+        } else if (nkeywords > 6 && pos == 4) {
+            SubBytes_keys(&column);
+        }
+        if (++pos == nkeywords) pos = 0;
+        KeySetupColumnMix(&column, &wide[i >> 2], &wide[(i - nkeywords) >> 2], i & 3, (i - nkeywords) & 3);
+    }
+
+    for (i = 0; i < nrounds + 1; i++) {
+        for (j = 0; j < nkeys; j++) {
+            AES_state* key_rounds = (AES_state*)((unsigned char*)rounds + j * stride);
+            for (b = 0; b < 8; b++) {
+                key_rounds[i].slice[b] = wide[i].slice[b] >> (16 * j);
+            }
+        }
+    }
+}
+
+/** Expand the cipher keys of nkeys keys into their key schedules, as
+ *  AES_setup_keys does, but for any number of keys.
+ */
+static void AES_setup_many(AES_state* rounds, size_t stride, const uint8_t* keys, size_t nkeys, int nkeywords, int nrounds)
+{
+    size_t done;
+
+#ifdef HAVE_AESNI
+    {
+        AES_active local[NUM_BACKENDS + 2];
+        if (ActiveBackends(local)->backend->encrypt == AES_encrypt_aesni) {
+            /* Compute the byte order key schedules in hardware, and slice them. */
+            for (done = 0; done < nkeys; done++) {
+                AES_state* key_rounds = (AES_state*)((unsigned char*)rounds + done * stride);
+                unsigned char rounds_bytes[15 * 16];
+                int i;
+                AES_setup_aesni(rounds_bytes, keys + 4 * nkeywords * done, nkeywords, nrounds);
+                for (i = 0; i < nrounds + 1; i++) {
+                    LoadBytes(&key_rounds[i], rounds_bytes + 16 * i);
+                }
+            }
+            return;
+        }
+    }
+#endif
+
+    for (done = 0; done < nkeys; done += KEYS_AT_ONCE) {
+        int n = nkeys - done < KEYS_AT_ONCE ? (int)(nkeys - done) : KEYS_AT_ONCE;
+        AES_setup_keys((AES_state*)((unsigned char*)rounds + done * stride), stride, keys + 4 * nkeywords * done, n, nkeywords, nrounds);
+    }
+}
+
+/** Expand the cipher key into the key schedule.
+ *
+ *  state must be a pointer to an array of size nrounds + 1.
+ *  key must be a pointer to 4 * nkeywords bytes.
+ *
+ *  AES128 uses nkeywords = 4, nrounds = 10
+ *  AES192 uses nkeywords = 6, nrounds = 12
+ *  AES256 uses nkeywords = 8, nrounds = 14
+ */
+static void AES_setup(AES_state* rounds, const uint8_t* key, int nkeywords, int nrounds)
+{
+    AES_setup_many(rounds, 0, key, 1, nkeywords, nrounds);
+}
+
+/** Expand the cipher key into a decryption key schedule.
+ *
+ *  The same as AES_setup, and rounds_bytes (16 * (nrounds + 1) bytes)
+ *  receives the round keys in byte order for the Equivalent Inverse Cipher:
+ *  in reverse order, with InvMixColumns applied to all but the first and last.
+ */
+static void AES_setup_dec(AES_state* rounds, unsigned char* rounds_bytes, const uint8_t* key, int nkeywords, int nrounds)
+{
+    int i;
+    AES_setup(rounds, key, nkeywords, nrounds);
+    for (i = 0; i <= nrounds; i++) {
+        AES_state round = rounds[nrounds - i];
+        if (i > 0 && i < nrounds) {
+            InvMixColumns(&round);
+        }
+        SaveBytes(rounds_bytes + 16 * i, &round);
+    }
+}
+
+void AES_set_portable(int portable) {
+    use_portable = portable;
+    active_state = 0;
+}
+
+const char* AES_backend_name(size_t i) {
+    size_t j;
+    for (j = 0; j < NUM_BACKENDS; j++) {
+        if (backends[j].supported == NULL || backends[j].supported()) {
+            if (i-- == 0) {
+                return backends[j].name;
+            }
+        }
+    }
+    return NULL;
+}
+
+void AES_autotune(void) {
+    Autotune();
+    active_state = 0;
+}
+
+void AES_autotune_timings(const double* overhead, const double* per_block) {
+    AES_timing timing[NUM_BACKENDS];
+    size_t i, j = 0;
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        if (backends[i].supported == NULL || backends[i].supported()) {
+            timing[i].overhead = overhead[j];
+            timing[i].per_block = per_block[j++];
+        }
+    }
+    TuneBackends(timing);
+    active_state = 0;
+}
+
+int AES_autotune_load(const char* path) {
+    int ok = LoadTuning(path);
+    active_state = 0;
+    return ok;
+}
+
+int AES_autotune_save(const char* path) {
+    return SaveTuning(path);
+}
+
+int AES_set_backend(const char* name) {
+    const AES_backend* backend = NULL;
+    if (name != NULL) {
+        backend = FindBackend(name);
+        if (backend == NULL) {
+            return 0;
+        }
+    }
+    backend_set = 1;
+    forced_backend = backend;
+    active_state = 0;
+    return 1;
+}
+
+void AES128_init(AES128_ctx* ctx, const unsigned char* key16) {
+    AES_setup(ctx->rk, key16, 4, 10);
+}
+
+void AES128_init_many(AES128_ctx* ctxs, size_t n, const unsigned char* keys16) {
+    AES_setup_many(ctxs[0].rk, sizeof(AES128_ctx), keys16, n, 4, 10);
+}
+
+void AES128_encrypt(const AES128_ctx* ctx, size_t blocks, unsigned char* cipher16, const unsigned char* plain16) {
+    AES_encrypt_blocks(ctx->rk, NULL, 10, blocks, cipher16, plain16);
+}
+
+void AES128_decrypt(const AES128_ctx* ctx, size_t blocks, unsigned char* plain16, const unsigned char* cipher16) {
+    AES_decrypt_blocks(ctx->rk, NULL, 0, 10, blocks, plain16, cipher16);
+}
+
+void AES128_encrypt_many(const AES128_ctx* const* ctxs, size_t n, unsigned char* const* cipher16, const unsigned char* const* plain16) {
+    AES_keys keys[LANES_CHUNK];
+    size_t done, i;
+    for (done = 0; done < n; done += i) {
+        for (i = 0; i < LANES_CHUNK && done + i < n; i++) {
+            InitKeys(&keys[i], ctxs[done + i]->rk, NULL, 10);
+        }
+        AES_encrypt_lanes(keys, i, cipher16 + done, plain16 + done);
+    }
+}
+
+void AES128_decrypt_many(const AES128_ctx* const* ctxs, size_t n, unsigned char* const* plain16, const unsigned char* const* cipher16) {
+    AES_keys keys[LANES_CHUNK];
+    size_t done, i;
+    for (done = 0; done < n; done += i) {
+        for (i = 0; i < LANES_CHUNK && done + i < n; i++) {
+            InitKeys(&keys[i], ctxs[done + i]->rk, NULL, 10);
+        }
+        AES_decrypt_lanes(keys, i, plain16 + done, cipher16 + done);
+    }
+}
+
+void AES128_dec_init(AES128_dec_ctx* ctx, const unsigned char* key16) {
+    AES_setup_dec(ctx->rk, ctx->rk_bytes[0], key16, 4, 10);
+}
+
+void AES128_dec_decrypt(const AES128_dec_ctx* ctx, size_t blocks, unsigned char* plain16, const unsigned char* cipher16) {
+    AES_decrypt_blocks(ctx->rk, ctx->rk_bytes[0], 1, 10, blocks, plain16, cipher16);
+}
+
+void AES192_init(AES192_ctx* ctx, const unsigned char* key24) {
+    AES_setup(ctx->rk, key24, 6, 12);
+}
+
+void AES192_init_many(AES192_ctx* ctxs, size_t n, const unsigned char* keys24) {
+    AES_setup_many(ctxs[0].rk, sizeof(AES192_ctx), keys24, n, 6, 12);
+}
+
+void AES192_encrypt(const AES192_ctx* ctx, size_t blocks, unsigned char* cipher16, const unsigned char* plain16) {
+    AES_encrypt_blocks(ctx->rk, NULL, 12, blocks, cipher16, plain16);
+}
+
+void AES192_decrypt(const AES192_ctx* ctx, size_t blocks, unsigned char* plain16, const unsigned char* cipher16) {
+    AES_decrypt_blocks(ctx->rk, NULL, 0, 12, blocks, plain16, cipher16);
+}
+
+void AES192_encrypt_many(const AES192_ctx* const* ctxs, size_t n, unsigned char* const* cipher16, const unsigned char* const* plain16) {
+    AES_keys keys[LANES_CHUNK];
+    size_t done, i;
+    for (done = 0; done < n; done += i) {
+        for (i = 0; i < LANES_CHUNK && done + i < n; i++) {
+            InitKeys(&keys[i], ctxs[done + i]->rk, NULL, 12);
+        }
+        AES_encrypt_lanes(keys, i, cipher16 + done, plain16 + done);
+    }
+}
+
+void AES192_decrypt_many(const AES192_ctx* const* ctxs, size_t n, unsigned char* const* plain16, const unsigned char* const* cipher16) {
+    AES_keys keys[LANES_CHUNK];
+    size_t done, i;
+    for (done = 0; done < n; done += i) {
+        for (i = 0; i < LANES_CHUNK && done + i < n; i++) {
+            InitKeys(&keys[i], ctxs[done + i]->rk, NULL, 12);
+        }
+        AES_decrypt_lanes(keys, i, plain16 + done, cipher16 + done);
+    }
+}
+
+void AES192_dec_init(AES192_dec_ctx* ctx, const unsigned char* key24) {
+    AES_setup_dec(ctx->rk, ctx->rk_bytes[0], key24, 6, 12);
+}
+
+void AES192_dec_decrypt(const AES192_dec_ctx* ctx, size_t blocks, unsigned char* plain16, const unsigned char* cipher16) {
+    AES_decrypt_blocks(ctx->rk, ctx->rk_bytes[0], 1, 12, blocks, plain16, cipher16);
+}
+
+void AES256_init(AES256_ctx* ctx, const unsigned char* key32) {
+    AES_setup(ctx->rk, key32, 8, 14);
+}
+
+void AES256_init_many(AES256_ctx* ctxs, size_t n, const unsigned char* keys32) {
+    AES_setup_many(ctxs[0].rk, sizeof(AES256_ctx), keys32, n, 8, 14);
+}
+
+void AES256_encrypt(const AES256_ctx* ctx, size_t blocks, unsigned char* cipher16, const unsigned char* plain16) {
+    AES_encrypt_blocks(ctx->rk, NULL, 14, blocks, cipher16, plain16);
 }
 
-/** Load 16 bytes of data into 8 sliced integers */
-static void LoadBytes(AES_state *s, const unsigned char* data16) {
-    int c;
-    for (c = 0; c < 4; c++) {
-        int r;
-        for (r = 0; r < 4; r++) {
-            LoadByte(s, *(data16++), r, c);
+void AES256_decrypt(const AES256_ctx* ctx, size_t blocks, unsigned char* plain16, const unsigned char* cipher16) {
+    AES_decrypt_blocks(ctx->rk, NULL, 0, 14, blocks, plain16, cipher16);
+}
+
+void AES256_encrypt_many(const AES256_ctx* const* ctxs, size_t n, unsigned char* const* cipher16, const unsigned char* const* plain16) {
+    AES_keys keys[LANES_CHUNK];
+    size_t done, i;
+    for (done = 0; done < n; done += i) {
+        for (i = 0; i < LANES_CHUNK && done + i < n; i++) {
+            InitKeys(&keys[i], ctxs[done + i]->rk, NULL, 14);
         }
+        AES_encrypt_lanes(keys, i, cipher16 + done, plain16 + done);
     }
 }
 
-/** Convert 8 sliced integers into 16 bytes of data */
-static void SaveBytes(unsigned char* data16, const AES_state *s) {
-    int c;
-    for (c = 0; c < 4; c++) {
-        int r;
-        for (r = 0; r < 4; r++) {
-            int b;
-            uint8_t v = 0;
-            for (b = 0; b < 8; b++) {
-                v |= ((s->slice[b] >> (r * 4 + c)) & 1) << b;
-            }
-            *(data16++) = v;
+void AES256_decrypt_many(const AES256_ctx* const* ctxs, size_t n, unsigned char* const* plain16, const unsigned char* const* cipher16) {
+    AES_keys keys[LANES_CHUNK];
+    size_t done, i;
+    for (done = 0; done < n; done += i) {
+        for (i = 0; i < LANES_CHUNK && done + i < n; i++) {
+            InitKeys(&keys[i], ctxs[done + i]->rk, NULL, 14);
         }
+        AES_decrypt_lanes(keys, i, plain16 + done, cipher16 + done);
     }
 }
 
-/* S-box implementation based on the gate logic from:
- *   Joan Boyar and Rene Peralta, A depth-16 circuit for the AES S-box.
- *   https://eprint.iacr.org/2011/332.pdf
-*/
-static void SubBytes(AES_state *s, int inv) {
-    /* Load the bit slices */
-    uint16_t U0 = s->slice[7], U1 = s->slice[6], U2 = s->slice[5], U3 = s->slice[4];
-    uint16_t U4 = s->slice[3], U5 = s->slice[2], U6 = s->slice[1], U7 = s->slice[0];
+void AES256_dec_init(AES256_dec_ctx* ctx, const unsigned char* key32) {
+    AES_setup_dec(ctx->rk, ctx->rk_bytes[0], key32, 8, 14);
+}
 
-    uint16_t T1, T2, T3, T4, T5, T6, T7, T8, T9, T10, T11, T12, T13, T14, T15, T16;
-    uint16_t T17, T18, T19, T20, T21, T22, T23, T24, T25, T26, T27, D;
-    uint16_t M1, M6, M11, M13, M15, M20, M21, M22, M23, M25, M37, M38, M39, M40;
-    uint16_t M41, M42, M43, M44, M45, M46, M47, M48, M49, M50, M51, M52, M53, M54;
-    uint16_t M55, M56, M57, M58, M59, M60, M61, M62, M63;
+void AES256_dec_decrypt(const AES256_dec_ctx* ctx, size_t blocks, unsigned char* plain16, const unsigned char* cipher16) {
+    AES_decrypt_blocks(ctx->rk, ctx->rk_bytes[0], 1, 14, blocks, plain16, cipher16);
+}
 
-    if (inv) {
-        uint16_t R5, R13, R17, R18, R19;
-        /* Undo linear postprocessing */
-        T23 = U0 ^ U3;
-        T22 = ~(U1 ^ U3);
-        T2 = ~(U0 ^ U1);
-        T1 = U3 ^ U4;
-        T24 = ~(U4 ^ U7);
-        R5 = U6 ^ U7;
-        T8 = ~(U1 ^ T23);
-        T19 = T22 ^ R5;
-        T9 = ~(U7 ^ T1);
-        T10 = T2 ^ T24;
-        T13 = T2 ^ R5;
-        T3 = T1 ^ R5;
-        T25 = ~(U2 ^ T1);
-        R13 = U1 ^ U6;
-        T17 = ~(U2 ^ T19);
-        T20 = T24 ^ R13;
-        T4 = U4 ^ T8;
-        R17 = ~(U2 ^ U5);
-        R18 = ~(U5 ^ U6);
-        R19 = ~(U2 ^ U4);
-        D = U0 ^ R17;
-        T6 = T22 ^ R17;
-        T16 = R13 ^ R19;
-        T27 = T1 ^ R18;
-        T15 = T10 ^ T27;
-        T14 = T10 ^ R18;
-        T26 = T3 ^ T16;
-    } else {
-        /* Linear preprocessing. */
-        T1 = U0 ^ U3;
-        T2 = U0 ^ U5;
-        T3 = U0 ^ U6;
-        T4 = U3 ^ U5;
-        T5 = U4 ^ U6;
-        T6 = T1 ^ T5;
-        T7 = U1 ^ U2;
-        T8 = U7 ^ T6;
-        T9 = U7 ^ T7;
-        T10 = T6 ^ T7;
-        T11 = U1 ^ U5;
-        T12 = U2 ^ U5;
-        T13 = T3 ^ T4;
-        T14 = T6 ^ T11;
-        T15 = T5 ^ T11;
-        T16 = T5 ^ T12;
-        T17 = T9 ^ T16;
-        T18 = U3 ^ U7;
-        T19 = T7 ^ T18;
-        T20 = T1 ^ T19;
-        T21 = U6 ^ U7;
-        T22 = T7 ^ T21;
-        T23 = T2 ^ T22;
-        T24 = T2 ^ T10;
-        T25 = T20 ^ T17;
-        T26 = T3 ^ T16;
-        T27 = T1 ^ T12;
-        D = U7;
-    }
-
-    /* Non-linear transformation (shared between the forward and backward case) */
-    M1 = T13 & T6;
-    M6 = T3 & T16;
-    M11 = T1 & T15;
-    M13 = (T4 & T27) ^ M11;
-    M15 = (T2 & T10) ^ M11;
-    M20 = T14 ^ M1 ^ (T23 & T8) ^ M13;
-    M21 = (T19 & D) ^ M1 ^ T24 ^ M15;
-    M22 = T26 ^ M6 ^ (T22 & T9) ^ M13;
-    M23 = (T20 & T17) ^ M6 ^ M15 ^ T25;
-    M25 = M22 & M20;
-    M37 = M21 ^ ((M20 ^ M21) & (M23 ^ M25));
-    M38 = M20 ^ M25 ^ (M21 | (M20 & M23));
-    M39 = M23 ^ ((M22 ^ M23) & (M21 ^ M25));
-    M40 = M22 ^ M25 ^ (M23 | (M21 & M22));
-    M41 = M38 ^ M40;
-    M42 = M37 ^ M39;
-    M43 = M37 ^ M38;
-    M44 = M39 ^ M40;
-    M45 = M42 ^ M41;
-    M46 = M44 & T6;
-    M47 = M40 & T8;
-    M48 = M39 & D;
-    M49 = M43 & T16;
-    M50 = M38 & T9;
-    M51 = M37 & T17;
-    M52 = M42 & T15;
-    M53 = M45 & T27;
-    M54 = M41 & T10;
-    M55 = M44 & T13;
-    M56 = M40 & T23;
-    M57 = M39 & T19;
-    M58 = M43 & T3;
-    M59 = M38 & T22;
-    M60 = M37 & T20;
-    M61 = M42 & T1;
-    M62 = M45 & T4;
-    M63 = M41 & T2;
-
-    if (inv){
-        /* Undo linear preprocessing */
-        uint16_t P0 = M52 ^ M61;
-        uint16_t P1 = M58 ^ M59;
-        uint16_t P2 = M54 ^ M62;
-        uint16_t P3 = M47 ^ M50;
-        uint16_t P4 = M48 ^ M56;
-        uint16_t P5 = M46 ^ M51;
-        uint16_t P6 = M49 ^ M60;
-        uint16_t P7 = P0 ^ P1;
-        uint16_t P8 = M50 ^ M53;
-        uint16_t P9 = M55 ^ M63;
-        uint16_t P10 = M57 ^ P4;
-        uint16_t P11 = P0 ^ P3;
-        uint16_t P12 = M46 ^ M48;
-        uint16_t P13 = M49 ^ M51;
-        uint16_t P14 = M49 ^ M62;
-        uint16_t P15 = M54 ^ M59;
-        uint16_t P16 = M57 ^ M61;
-        uint16_t P17 = M58 ^ P2;
-        uint16_t P18 = M63 ^ P5;
-        uint16_t P19 = P2 ^ P3;
-        uint16_t P20 = P4 ^ P6;
-        uint16_t P22 = P2 ^ P7;
-        uint16_t P23 = P7 ^ P8;
-        uint16_t P24 = P5 ^ P7;
-        uint16_t P25 = P6 ^ P10;
-        uint16_t P26 = P9 ^ P11;
-        uint16_t P27 = P10 ^ P18;
-        uint16_t P28 = P11 ^ P25;
-        uint16_t P29 = P15 ^ P20;
-        s->slice[7] = P13 ^ P22;
-        s->slice[6] = P26 ^ P29;
-        s->slice[5] = P17 ^ P28;
-        s->slice[4] = P12 ^ P22;
-        s->slice[3] = P23 ^ P27;
-        s->slice[2] = P19 ^ P24;
-        s->slice[1] = P14 ^ P23;
-        s->slice[0] = P9 ^ P16;
-    } else {
-        /* Linear postprocessing */
-        uint16_t L0 = M61 ^ M62;
-        uint16_t L1 = M50 ^ M56;
-        uint16_t L2 = M46 ^ M48;
-        uint16_t L3 = M47 ^ M55;
-        uint16_t L4 = M54 ^ M58;
-        uint16_t L5 = M49 ^ M61;
-        uint16_t L6 = M62 ^ L5;
-        uint16_t L7 = M46 ^ L3;
-        uint16_t L8 = M51 ^ M59;
-        uint16_t L9 = M52 ^ M53;
-        uint16_t L10 = M53 ^ L4;
-        uint16_t L11 = M60 ^ L2;
-        uint16_t L12 = M48 ^ M51;
-        uint16_t L13 = M50 ^ L0;
-        uint16_t L14 = M52 ^ M61;
-        uint16_t L15 = M55 ^ L1;
-        uint16_t L16 = M56 ^ L0;
-        uint16_t L17 = M57 ^ L1;
-        uint16_t L18 = M58 ^ L8;
-        uint16_t L19 = M63 ^ L4;
-        uint16_t L20 = L0 ^ L1;
-        uint16_t L21 = L1 ^ L7;
-        uint16_t L22 = L3 ^ L12;
-        uint16_t L23 = L18 ^ L2;
-        uint16_t L24 = L15 ^ L9;
-        uint16_t L25 = L6 ^ L10;
-        uint16_t L26 = L7 ^ L9;
-        uint16_t L27 = L8 ^ L10;
-        uint16_t L28 = L11 ^ L14;
-        uint16_t L29 = L11 ^ L17;
-        s->slice[7] = L6 ^ L24;
-        s->slice[6] = ~(L16 ^ L26);
-        s->slice[5] = ~(L19 ^ L28);
-        s->slice[4] = L6 ^ L21;
-        s->slice[3] = L20 ^ L22;
-        s->slice[2] = L25 ^ L29;
-        s->slice[1] = ~(L13 ^ L27);
-        s->slice[0] = ~(L6 ^ L23);
-    }
-}
-
-#define BIT_RANGE(from,to) ((uint16_t)((1 << ((to) - (from))) - 1) << (from))
-
-#define BIT_RANGE_LEFT(x,from,to,shift) (((x) & BIT_RANGE((from), (to))) << (shift))
-#define BIT_RANGE_RIGHT(x,from,to,shift) (((x) & BIT_RANGE((from), (to))) >> (shift))
-
-static void ShiftRows(AES_state* s) {
-    int i;
-    for (i = 0; i < 8; i++) {
-        uint16_t v = s->slice[i];
-        s->slice[i] =
-            (v & BIT_RANGE(0, 4)) |
-            BIT_RANGE_LEFT(v, 4, 5, 3) | BIT_RANGE_RIGHT(v, 5, 8, 1) |
-            BIT_RANGE_LEFT(v, 8, 10, 2) | BIT_RANGE_RIGHT(v, 10, 12, 2) |
-            BIT_RANGE_LEFT(v, 12, 15, 1) | BIT_RANGE_RIGHT(v, 15, 16, 3);
-    }
+/** Encrypt blocks blocks with the key schedule of key, expanded on the stack */
+static void AES_encrypt_otf(const uint8_t* key, int nkeywords, int nrounds, size_t blocks, unsigned char* cipher16, const unsigned char* plain16) {
+    AES_state rounds[15];
+    if (blocks == 0) return;
+    AES_setup(rounds, key, nkeywords, nrounds);
+    AES_encrypt_blocks(rounds, NULL, nrounds, blocks, cipher16, plain16);
 }
 
-static void InvShiftRows(AES_state* s) {
-    int i;
-    for (i = 0; i < 8; i++) {
-        uint16_t v = s->slice[i];
-        s->slice[i] =
-            (v & BIT_RANGE(0, 4)) |
-            BIT_RANGE_LEFT(v, 4, 7, 1) | BIT_RANGE_RIGHT(v, 7, 8, 3) |
-            BIT_RANGE_LEFT(v, 8, 10, 2) | BIT_RANGE_RIGHT(v, 10, 12, 2) |
-            BIT_RANGE_LEFT(v, 12, 13, 3) | BIT_RANGE_RIGHT(v, 13, 16, 1);
-    }
-}
-
-#define ROT(x,b) (((x) >> ((b) * 4)) | ((x) << ((4-(b)) * 4)))
-
-static void MixColumns(AES_state* s, int inv) {
-    /* The MixColumns transform treats the bytes of the columns of the state as
-     * coefficients of a 3rd degree polynomial over GF(2^8) and multiplies them
-     * by the fixed polynomial a(x) = {03}x^3 + {01}x^2 + {01}x + {02}, modulo
-     * x^4 + {01}.
-     *
-     * In the inverse transform, we multiply by the inverse of a(x),
-     * a^-1(x) = {0b}x^3 + {0d}x^2 + {09}x + {0e}. This is equal to
-     * a(x) * ({04}x^2 + {05}), so we can reuse the forward transform's code
-     * (found in OpenSSL's bsaes-x86_64.pl, attributed to Jussi Kivilinna)
-     *
-     * In the bitsliced representation, a multiplication of every column by x
-     * mod x^4 + 1 is simply a right rotation.
-     */
-
-    /* Shared for both directions is a multiplication by a(x), which can be
-     * rewritten as (x^3 + x^2 + x) + {02}*(x^3 + {01}).
-     *
-     * First compute s into the s? variables, (x^3 + {01}) * s into the s?_01
-     * variables and (x^3 + x^2 + x)*s into the s?_123 variables.
-     */
-    uint16_t s0 = s->slice[0], s1 = s->slice[1], s2 = s->slice[2], s3 = s->slice[3];
-    uint16_t s4 = s->slice[4], s5 = s->slice[5], s6 = s->slice[6], s7 = s->slice[7];
-    uint16_t s0_01 = s0 ^ ROT(s0, 1), s0_123 = ROT(s0_01, 1) ^ ROT(s0, 3);
-    uint16_t s1_01 = s1 ^ ROT(s1, 1), s1_123 = ROT(s1_01, 1) ^ ROT(s1, 3);
-    uint16_t s2_01 = s2 ^ ROT(s2, 1), s2_123 = ROT(s2_01, 1) ^ ROT(s2, 3);
-    uint16_t s3_01 = s3 ^ ROT(s3, 1), s3_123 = ROT(s3_01, 1) ^ ROT(s3, 3);
-    uint16_t s4_01 = s4 ^ ROT(s4, 1), s4_123 = ROT(s4_01, 1) ^ ROT(s4, 3);
-    uint16_t s5_01 = s5 ^ ROT(s5, 1), s5_123 = ROT(s5_01, 1) ^ ROT(s5, 3);
-    uint16_t s6_01 = s6 ^ ROT(s6, 1), s6_123 = ROT(s6_01, 1) ^ ROT(s6, 3);
-    uint16_t s7_01 = s7 ^ ROT(s7, 1), s7_123 = ROT(s7_01, 1) ^ ROT(s7, 3);
-    /* Now compute s = s?_123 + {02} * s?_01. */
-    s->slice[0] = s7_01 ^ s0_123;
-    s->slice[1] = s7_01 ^ s0_01 ^ s1_123;
-    s->slice[2] = s1_01 ^ s2_123;
-    s->slice[3] = s7_01 ^ s2_01 ^ s3_123;
-    s->slice[4] = s7_01 ^ s3_01 ^ s4_123;
-    s->slice[5] = s4_01 ^ s5_123;
-    s->slice[6] = s5_01 ^ s6_123;
-    s->slice[7] = s6_01 ^ s7_123;
-    if (inv) {
-        /* In the reverse direction, we further need to multiply by
-         * {04}x^2 + {05}, which can be written as {04} * (x^2 + {01}) + {01}.
-         *
-         * First compute (x^2 + {01}) * s into the t?_02 variables: */
-        uint16_t t0_02 = s->slice[0] ^ ROT(s->slice[0], 2);
-        uint16_t t1_02 = s->slice[1] ^ ROT(s->slice[1], 2);
-        uint16_t t2_02 = s->slice[2] ^ ROT(s->slice[2], 2);
-        uint16_t t3_02 = s->slice[3] ^ ROT(s->slice[3], 2);
-        uint16_t t4_02 = s->slice[4] ^ ROT(s->slice[4], 2);
-        uint16_t t5_02 = s->slice[5] ^ ROT(s->slice[5], 2);
-        uint16_t t6_02 = s->slice[6] ^ ROT(s->slice[6], 2);
-        uint16_t t7_02 = s->slice[7] ^ ROT(s->slice[7], 2);
-        /* And then update s += {04} * t?_02 */
-        s->slice[0] ^= t6_02;
-        s->slice[1] ^= t6_02 ^ t7_02;
-        s->slice[2] ^= t0_02 ^ t7_02;
-        s->slice[3] ^= t1_02 ^ t6_02;
-        s->slice[4] ^= t2_02 ^ t6_02 ^ t7_02;
-        s->slice[5] ^= t3_02 ^ t7_02;
-        s->slice[6] ^= t4_02;
-        s->slice[7] ^= t5_02;
-    }
-}
-
-static void AddRoundKey(AES_state* s, const AES_state* round) {
-    int b;
-    for (b = 0; b < 8; b++) {
-        s->slice[b] ^= round->slice[b];
-    }
+/** Decrypt blocks blocks with the key schedule of key, expanded on the stack */
+static void AES_decrypt_otf(const uint8_t* key, int nkeywords, int nrounds, size_t blocks, unsigned char* plain16, const unsigned char* cipher16) {
+    AES_state rounds[15];
+    if (blocks == 0) return;
+    AES_setup(rounds, key, nkeywords, nrounds);
+    AES_decrypt_blocks(rounds, NULL, 0, nrounds, blocks, plain16, cipher16);
 }
 
-/** column_0(s) = column_c(a) */
-static void GetOneColumn(AES_state* s, const AES_state* a, int c) {
-    int b;
-    for (b = 0; b < 8; b++) {
-        s->slice[b] = (a->slice[b] >> c) & 0x1111;
-    }
+void AES128_otf_init(AES128_otf_ctx* ctx, const unsigned char* key16) {
+    memcpy(ctx->key, key16, 16);
 }
 
-/** column_c1(r) |= (column_0(s) ^= column_c2(a)) */
-static void KeySetupColumnMix(AES_state* s, AES_state* r, const AES_state* a, int c1, int c2) {
-    int b;
-    for (b = 0; b < 8; b++) {
-        r->slice[b] |= ((s->slice[b] ^= ((a->slice[b] >> c2) & 0x1111)) & 0x1111) << c1;
-    }
+void AES128_otf_encrypt(const AES128_otf_ctx* ctx, size_t blocks, unsigned char* cipher16, const unsigned char* plain16) {
+    AES_encrypt_otf(ctx->key, 4, 10, blocks, cipher16, plain16);
 }
 
-/** Rotate the rows in s one position upwards, and xor in r */
-static void KeySetupTransform(AES_state* s, const AES_state* r) {
-    int b;
-    for (b = 0; b < 8; b++) {
-        s->slice[b] = ((s->slice[b] >> 4) | (s->slice[b] << 12)) ^ r->slice[b];
-    }
+void AES128_otf_decrypt(const AES128_otf_ctx* ctx, size_t blocks, unsigned char* plain16, const unsigned char* cipher16) {
+    AES_decrypt_otf(ctx->key, 4, 10, blocks, plain16, cipher16);
 }
 
-/* Multiply the cells in s by x, as polynomials over GF(2) mod x^8 + x^4 + x^3 + x + 1 */
-static void MultX(AES_state* s) {
-    uint16_t top = s->slice[7];
-    s->slice[7] = s->slice[6];
-    s->slice[6] = s->slice[5];
-    s->slice[5] = s->slice[4];
-    s->slice[4] = s->slice[3] ^ top;
-    s->slice[3] = s->slice[2] ^ top;
-    s->slice[2] = s->slice[1];
-    s->slice[1] = s->slice[0] ^ top;
-    s->slice[0] = top;
+void AES192_otf_init(AES192_otf_ctx* ctx, const unsigned char* key24) {
+    memcpy(ctx->key, key24, 24);
 }
 
-/** Expand the cipher key into the key schedule.
- *
- *  state must be a pointer to an array of size nrounds + 1.
- *  key must be a pointer to 4 * nkeywords bytes.
- *
- *  AES128 uses nkeywords = 4, nrounds = 10
- *  AES192 uses nkeywords = 6, nrounds = 12
- *  AES256 uses nkeywords = 8, nrounds = 14
- */
-static void AES_setup(AES_state* rounds, const uint8_t* key, int nkeywords, int nrounds)
-{
-    int i;
+void AES192_otf_encrypt(const AES192_otf_ctx* ctx, size_t blocks, unsigned char* cipher16, const unsigned char* plain16) {
+    AES_encrypt_otf(ctx->key, 6, 12, blocks, cipher16, plain16);
+}
 
-    /* The one-byte round constant */
-    AES_state rcon = {{1,0,0,0,0,0,0,0}};
-    /* The number of the word being generated, modulo nkeywords */
-    int pos = 0;
-    /* The column representing the word currently being processed */
-    AES_state column;
+void AES192_otf_decrypt(const AES192_otf_ctx* ctx, size_t blocks, unsigned char* plain16, const unsigned char* cipher16) {
+    AES_decrypt_otf(ctx->key, 6, 12, blocks, plain16, cipher16);
+}
 
-    for (i = 0; i < nrounds + 1; i++) {
-        int b;
-        for (b = 0; b < 8; b++) {
-            rounds[i].slice[b] = 0;
-        }
+void AES256_otf_init(AES256_otf_ctx* ctx, const unsigned char* key32) {
+    memcpy(ctx->key, key32, 32);
+}
+
+void AES256_otf_encrypt(const AES256_otf_ctx* ctx, size_t blocks, unsigned char* cipher16, const unsigned char* plain16) {
+    AES_encrypt_otf(ctx->key, 8, 14, blocks, cipher16, plain16);
+}
+
+void AES256_otf_decrypt(const AES256_otf_ctx* ctx, size_t blocks, unsigned char* plain16, const unsigned char* cipher16) {
+    AES_decrypt_otf(ctx->key, 8, 14, blocks, plain16, cipher16);
+}
+
+/* The most bytes per round key that AES128_wide_ctx and the others have room for. */
+#define WIDE_ROUND_BYTES 256
+
+/** The offset of the first 64-byte aligned address in wide */
+static size_t WideOffset(const unsigned char* wide) {
+    return (64 - ((uintptr_t)wide & 63)) & 63;
+}
+
+/** Expand the cipher key into the key schedule, as AES_setup does, and
+ *  prepare the round keys in wide for the backend used for the largest calls.
+ */
+static void AES_setup_wide(AES_state* rounds, int* wide_backend, int* wide_offset, unsigned char* wide, const uint8_t* key, int nkeywords, int nrounds) {
+    AES_active local[NUM_BACKENDS + 2];
+    const AES_backend* backend = ActiveBackends(local)->backend;
+    AES_setup(rounds, key, nkeywords, nrounds);
+    *wide_backend = 0;
+    *wide_offset = (uintptr_t)wide & 63;
+    if (backend->load_keys && backend->group * 16 <= WIDE_ROUND_BYTES) {
+        backend->load_keys(wide + WideOffset(wide), rounds, nrounds);
+        *wide_backend = 1 + (backend - backends);
     }
+}
 
-    /* The first nkeywords round columns are just taken from the key directly. */
-    for (i = 0; i < nkeywords; i++) {
-        int r;
-        for (r = 0; r < 4; r++) {
-            LoadByte(&rounds[i >> 2], *(key++), r, i & 3);
-        }
+/** Set up keys for the round keys of a wide context */
+static void InitWideKeys(AES_keys* keys, const AES_state* rounds, int wide_backend, int wide_offset, const unsigned char* wide, int nrounds) {
+    InitKeys(keys, rounds, NULL, nrounds);
+    /* The prepared round keys moved if the context was copied to an address with another alignment. */
+    if (wide_backend && (int)((uintptr_t)wide & 63) == wide_offset) {
+        keys->wide_rounds = wide + WideOffset(wide);
+        keys->wide_load = backends[wide_backend - 1].load_keys;
     }
+}
 
-    GetOneColumn(&column, &rounds[(nkeywords - 1) >> 2], (nkeywords - 1) & 3);
+void AES128_wide_init(AES128_wide_ctx* ctx, const unsigned char* key16) {
+    AES_setup_wide(ctx->ctx.rk, &ctx->wide_backend, &ctx->wide_offset, ctx->wide, key16, 4, 10);
+}
 
-    for (i = nkeywords; i < 4 * (nrounds + 1); i++) {
-        /* Transform column */
-        if (pos == 0) {
-            SubBytes(&column, 0);
-            KeySetupTransform(&column, &rcon);
-            MultX(&rcon);
-        } else if (nkeywords > 6 && pos == 4) {
-            SubBytes(&column, 0);
-        }
-        if (++pos == nkeywords) pos = 0;
-        KeySetupColumnMix(&column, &rounds[i >> 2], &rounds[(i - nkeywords) >> 2], i & 3, (i - nkeywords) & 3);
-    }
+void AES128_wide_encrypt(const AES128_wide_ctx* ctx, size_t blocks, unsigned char* cipher16, const unsigned char* plain16) {
+    AES_keys keys;
+    InitWideKeys(&keys, ctx->ctx.rk, ctx->wide_backend, ctx->wide_offset, ctx->wide, 10);
+    AES_encrypt_keys(&keys, blocks, cipher16, plain16);
 }
 
-static void AES_encrypt(const AES_state* rounds, int nrounds, unsigned char* cipher16, const unsigned char* plain16) {
-    AES_state s = {{0}};
-    int round;
+void AES128_wide_decrypt(const AES128_wide_ctx* ctx, size_t blocks, unsigned char* plain16, const unsigned char* cipher16) {
+    AES_keys keys;
+    InitWideKeys(&keys, ctx->ctx.rk, ctx->wide_backend, ctx->wide_offset, ctx->wide, 10);
+    AES_decrypt_keys(&keys, 0, blocks, plain16, cipher16);
+}
 
-    LoadBytes(&s, plain16);
-    AddRoundKey(&s, rounds++);
+void AES192_wide_init(AES192_wide_ctx* ctx, const unsigned char* key24) {
+    AES_setup_wide(ctx->ctx.rk, &ctx->wide_backend, &ctx->wide_offset, ctx->wide, key24, 6, 12);
+}
 
-    for (round = 1; round < nrounds; round++) {
-        SubBytes(&s, 0);
-        ShiftRows(&s);
-        MixColumns(&s, 0);
-        AddRoundKey(&s, rounds++);
-    }
+void AES192_wide_encrypt(const AES192_wide_ctx* ctx, size_t blocks, unsigned char* cipher16, const unsigned char* plain16) {
+    AES_keys keys;
+    InitWideKeys(&keys, ctx->ctx.rk, ctx->wide_backend, ctx->wide_offset, ctx->wide, 12);
+    AES_encrypt_keys(&keys, blocks, cipher16, plain16);
+}
 
-    SubBytes(&s, 0);
-    ShiftRows(&s);
-    AddRoundKey(&s, rounds);
+void AES192_wide_decrypt(const AES192_wide_ctx* ctx, size_t blocks, unsigned char* plain16, const unsigned char* cipher16) {
+    AES_keys keys;
+    InitWideKeys(&keys, ctx->ctx.rk, ctx->wide_backend, ctx->wide_offset, ctx->wide, 12);
+    AES_decrypt_keys(&keys, 0, blocks, plain16, cipher16);
+}
 
-    SaveBytes(cipher16, &s);
+void AES256_wide_init(AES256_wide_ctx* ctx, const unsigned char* key32) {
+    AES_setup_wide(ctx->ctx.rk, &ctx->wide_backend, &ctx->wide_offset, ctx->wide, key32, 8, 14);
 }
 
-static void AES_decrypt(const AES_state* rounds, int nrounds, unsigned char* plain16, const unsigned char* cipher16) {
-    /* Most AES decryption implementations use the alternate scheme
-     * (the Equivalent Inverse Cipher), which allows for more code reuse between
-     * the encryption and decryption code, but requires separate setup for both.
-     */
-    AES_state s = {{0}};
-    int round;
+void AES256_wide_encrypt(const AES256_wide_ctx* ctx, size_t blocks, unsigned char* cipher16, const unsigned char* plain16) {
+    AES_keys keys;
+    InitWideKeys(&keys, ctx->ctx.rk, ctx->wide_backend, ctx->wide_offset, ctx->wide, 14);
+    AES_encrypt_keys(&keys, blocks, cipher16, plain16);
+}
 
-    rounds += nrounds;
+void AES256_wide_decrypt(const AES256_wide_ctx* ctx, size_t blocks, unsigned char* plain16, const unsigned char* cipher16) {
+    AES_keys keys;
+    InitWideKeys(&keys, ctx->ctx.rk, ctx->wide_backend, ctx->wide_offset, ctx->wide, 14);
+    AES_decrypt_keys(&keys, 0, blocks, plain16, cipher16);
+}
 
-    LoadBytes(&s, cipher16);
-    AddRoundKey(&s, rounds--);
+/* The size of a key store header, see AES128_keystore_build. */
+#define KEYSTORE_HEADER 32
 
-    for (round = 1; round < nrounds; round++) {
-        InvShiftRows(&s);
-        SubBytes(&s, 1);
-        AddRoundKey(&s, rounds--);
-        MixColumns(&s, 1);
-    }
+/* The key store format version. Version 1 had larger contexts, which also held
+ * the round keys in byte order. */
+#define KEYSTORE_VERSION 2
 
-    InvShiftRows(&s);
-    SubBytes(&s, 1);
-    AddRoundKey(&s, rounds);
+static const unsigned char keystore_magic[8] = {'c', 't', 'a', 'e', 's', 'k', 's', 0};
 
-    SaveBytes(plain16, &s);
+/** Whether this platform stores integers little endian, as key stores do */
+static int LittleEndian(void) {
+    uint16_t one = 1;
+    return *(unsigned char*)&one == 1;
 }
 
-void AES128_init(AES128_ctx* ctx, const unsigned char* key16) {
-    AES_setup(ctx->rk, key16, 4, 10);
+static uint64_t ReadLE64(const unsigned char* p) {
+    uint64_t x = 0;
+    int i;
+    for (i = 7; i >= 0; i--) {
+        x = (x << 8) | p[i];
+    }
+    return x;
 }
 
-void AES128_encrypt(const AES128_ctx* ctx, size_t blocks, unsigned char* cipher16, const unsigned char* plain16) {
-    while (blocks--) {
-        AES_encrypt(ctx->rk, 10, cipher16, plain16);
-        cipher16 += 16;
-        plain16 += 16;
+static void WriteLE64(unsigned char* p, uint64_t x) {
+    int i;
+    for (i = 0; i < 8; i++) {
+        p[i] = x;
+        x >>= 8;
     }
 }
 
-void AES128_decrypt(const AES128_ctx* ctx, size_t blocks, unsigned char* plain16, const unsigned char* cipher16) {
-    while (blocks--) {
-        AES_decrypt(ctx->rk, 10, plain16, cipher16);
-        cipher16 += 16;
-        plain16 += 16;
+/** The checksum of a key store of len bytes (a multiple of 8), without bytes 24-31
+ *
+ *  Every 64-bit little endian word w is mixed in as h = (h ^ w) * P, followed
+ *  by h ^= h >> 32. Each step is invertible, so any change to a single word
+ *  always changes the result.
+ */
+static uint64_t KeystoreChecksum(const unsigned char* store, size_t len) {
+    uint64_t h = 0xcbf29ce484222325;
+    size_t i;
+    for (i = 0; i < len; i += 8) {
+        if (i == 24) continue;
+        h = (h ^ ReadLE64(store + i)) * 0x100000001b3;
+        h ^= h >> 32;
     }
+    return h;
 }
 
-void AES192_init(AES192_ctx* ctx, const unsigned char* key24) {
-    AES_setup(ctx->rk, key24, 6, 12);
+/** Fill in the header of a key store with n contexts of ctx_size bytes, after the contexts */
+static int KeystoreFinish(unsigned char* store, int keybits, size_t n, size_t ctx_size) {
+    if (!LittleEndian()) return 0;
+    memcpy(store, keystore_magic, 8);
+    WriteLE64(store + 8, KEYSTORE_VERSION | ((uint64_t)keybits << 32));
+    WriteLE64(store + 16, n);
+    WriteLE64(store + 24, KeystoreChecksum(store, KEYSTORE_HEADER + n * ctx_size));
+    return 1;
 }
 
-void AES192_encrypt(const AES192_ctx* ctx, size_t blocks, unsigned char* cipher16, const unsigned char* plain16) {
-    while (blocks--) {
-        AES_encrypt(ctx->rk, 12, cipher16, plain16);
-        cipher16 += 16;
-        plain16 += 16;
+/** Check a key store of len bytes with contexts of ctx_size bytes, returning the number of contexts, or (size_t)-1 if it is invalid */
+static size_t KeystoreCheck(const unsigned char* store, size_t len, int keybits, size_t ctx_size) {
+    uint64_t n;
+    if (!LittleEndian() || ((uintptr_t)store & (sizeof(uint16_t) - 1)) || len < KEYSTORE_HEADER) return (size_t)-1;
+    n = ReadLE64(store + 16);
+    if (memcmp(store, keystore_magic, 8) || ReadLE64(store + 8) != (KEYSTORE_VERSION | ((uint64_t)keybits << 32)) ||
+        n != (len - KEYSTORE_HEADER) / ctx_size || len != KEYSTORE_HEADER + n * ctx_size ||
+        ReadLE64(store + 24) != KeystoreChecksum(store, len)) {
+        return (size_t)-1;
     }
+    return n;
+}
 
+size_t AES128_keystore_size(size_t n) {
+    return KEYSTORE_HEADER + n * sizeof(AES128_ctx);
 }
 
-void AES192_decrypt(const AES192_ctx* ctx, size_t blocks, unsigned char* plain16, const unsigned char* cipher16) {
-    while (blocks--) {
-        AES_decrypt(ctx->rk, 12, plain16, cipher16);
-        cipher16 += 16;
-        plain16 += 16;
+int AES128_keystore_build(unsigned char* store, size_t n, const unsigned char* keys16) {
+    AES128_init_many((AES128_ctx*)(store + KEYSTORE_HEADER), n, keys16);
+    return KeystoreFinish(store, 128, n, sizeof(AES128_ctx));
+}
+
+const AES128_ctx* AES128_keystore_open(const unsigned char* store, size_t len, size_t* n) {
+    size_t count = KeystoreCheck(store, len, 128, sizeof(AES128_ctx));
+    if (count == (size_t)-1) {
+        *n = 0;
+        return NULL;
     }
+    *n = count;
+    return (const AES128_ctx*)(store + KEYSTORE_HEADER);
 }
 
-void AES256_init(AES256_ctx* ctx, const unsigned char* key32) {
-    AES_setup(ctx->rk, key32, 8, 14);
+size_t AES192_keystore_size(size_t n) {
+    return KEYSTORE_HEADER + n * sizeof(AES192_ctx);
 }
 
-void AES256_encrypt(const AES256_ctx* ctx, size_t blocks, unsigned char* cipher16, const unsigned char* plain16) {
-    while (blocks--) {
-        AES_encrypt(ctx->rk, 14, cipher16, plain16);
-        cipher16 += 16;
-        plain16 += 16;
+int AES192_keystore_build(unsigned char* store, size_t n, const unsigned char* keys24) {
+    AES192_init_many((AES192_ctx*)(store + KEYSTORE_HEADER), n, keys24);
+    return KeystoreFinish(store, 192, n, sizeof(AES192_ctx));
+}
+
+const AES192_ctx* AES192_keystore_open(const unsigned char* store, size_t len, size_t* n) {
+    size_t count = KeystoreCheck(store, len, 192, sizeof(AES192_ctx));
+    if (count == (size_t)-1) {
+        *n = 0;
+        return NULL;
     }
+    *n = count;
+    return (const AES192_ctx*)(store + KEYSTORE_HEADER);
 }
 
-void AES256_decrypt(const AES256_ctx* ctx, size_t blocks, unsigned char* plain16, const unsigned char* cipher16) {
-    while (blocks--) {
-        AES_decrypt(ctx->rk, 14, plain16, cipher16);
-        cipher16 += 16;
-        plain16 += 16;
+size_t AES256_keystore_size(size_t n) {
+    return KEYSTORE_HEADER + n * sizeof(AES256_ctx);
+}
+
+int AES256_keystore_build(unsigned char* store, size_t n, const unsigned char* keys32) {
+    AES256_init_many((AES256_ctx*)(store + KEYSTORE_HEADER), n, keys32);
+    return KeystoreFinish(store, 256, n, sizeof(AES256_ctx));
+}
+
+const AES256_ctx* AES256_keystore_open(const unsigned char* store, size_t len, size_t* n) {
+    size_t count = KeystoreCheck(store, len, 256, sizeof(AES256_ctx));
+    if (count == (size_t)-1) {
+        *n = 0;
+        return NULL;
     }
+    *n = count;
+    return (const AES256_ctx*)(store + KEYSTORE_HEADER);
 }
 
 static void Xor128(uint8_t* buf1, const uint8_t* buf2) {
@@ -564,31 +1753,94 @@ static void Xor128(uint8_t* buf1, const uint8_t* buf2) {
     }
 }
 
+/* Every block is encrypted on its own, so the round keys are converted to byte
+ * order up front, once, for the single block code that may need them. */
 static void AESCBC_encrypt(const AES_state* rounds, uint8_t* iv, int nk, size_t blocks, unsigned char* encrypted, const unsigned char* plain) {
+    AES_keys keys;
     size_t i;
-    unsigned char buf[16];
+    unsigned char buf[16], rounds_bytes[15 * 16];
 
+    LoadByteKeys(rounds_bytes, rounds, nk);
+    InitKeys(&keys, rounds, rounds_bytes, nk);
     for (i = 0; i < blocks; i++) {
         memcpy(buf, plain, 16);
         Xor128(buf, iv);
-        AES_encrypt(rounds, nk, encrypted, buf);
+        AES_encrypt_keys(&keys, 1, encrypted, buf);
         memcpy(iv, encrypted, 16);
         plain += 16;
         encrypted += 16;
     }
 }
 
-static void AESCBC_decrypt(const AES_state* rounds, uint8_t* iv, int nk, size_t blocks, unsigned char* plain, const unsigned char* encrypted) {
-    size_t i;
-    uint8_t next_iv[16];
-
-    for (i = 0; i < blocks; i++) {
-        memcpy(next_iv, encrypted, 16);
-        AES_decrypt(rounds, nk, plain, encrypted);
+/* The number of blocks AESCBC_decrypt decrypts at once, a multiple of every
+ * backend's group. */
+#define CBC_CHUNK 64
+
+/* Unlike encryption, CBC decryption of one block does not depend on the one
+ * before, so whole chunks go through the parallel code at once. The chunk's
+ * ciphertext is copied first, as it is still needed after decrypting it when
+ * plain == encrypted. */
+static void AESCBC_decrypt(const AES_state* rounds, const unsigned char* rounds_bytes, int eq, uint8_t* iv, int nk, size_t blocks, unsigned char* plain, const unsigned char* encrypted) {
+    AES_keys keys;
+    unsigned char buf[CBC_CHUNK * 16];
+
+    InitKeys(&keys, rounds, rounds_bytes, nk);
+    while (blocks > 0) {
+        size_t i, n = blocks < CBC_CHUNK ? blocks : CBC_CHUNK;
+        memcpy(buf, encrypted, n * 16);
+        AES_decrypt_keys(&keys, eq, n, plain, buf);
         Xor128(plain, iv);
-        memcpy(iv, next_iv, 16);
-        plain += 16;
-        encrypted += 16;
+        for (i = 1; i < n; i++) {
+            Xor128(plain + i * 16, buf + (i - 1) * 16);
+        }
+        memcpy(iv, buf + (n - 1) * 16, 16);
+        plain += n * 16;
+        encrypted += n * 16;
+        blocks -= n;
+    }
+}
+
+/* Encrypt up to CBC_CHUNK streams at a time. Every step XORs the next block
+ * of each active stream with its iv into buf, encrypts all of them with one
+ * AES_encrypt_keys call, and writes them back out. Finished streams are
+ * replaced by the next ones not yet started, so that the slots stay full. */
+static void AESCBC_encrypt_streams(const AES_state* rounds, int nk, size_t n, uint8_t* const* ivs, const size_t* blocks, unsigned char* const* encrypted, const unsigned char* const* plain) {
+    AES_keys keys;
+    unsigned char buf[CBC_CHUNK * 16], rounds_bytes[15 * 16];
+    size_t stream[CBC_CHUNK], pos[CBC_CHUNK];
+    size_t next = 0, active = 0;
+
+    /* As in AESCBC_encrypt, steps may have too few streams for the parallel code. */
+    LoadByteKeys(rounds_bytes, rounds, nk);
+    InitKeys(&keys, rounds, rounds_bytes, nk);
+    while (1) {
+        size_t i, left = 0;
+        while (active < CBC_CHUNK && next < n) {
+            if (blocks[next] > 0) {
+                stream[active] = next;
+                pos[active] = 0;
+                active++;
+            }
+            next++;
+        }
+        if (active == 0) {
+            break;
+        }
+        for (i = 0; i < active; i++) {
+            memcpy(buf + i * 16, plain[stream[i]] + pos[i] * 16, 16);
+            Xor128(buf + i * 16, ivs[stream[i]]);
+        }
+        AES_encrypt_keys(&keys, active, buf, buf);
+        for (i = 0; i < active; i++) {
+            memcpy(encrypted[stream[i]] + pos[i] * 16, buf + i * 16, 16);
+            memcpy(ivs[stream[i]], buf + i * 16, 16);
+            if (++pos[i] < blocks[stream[i]]) {
+                stream[left] = stream[i];
+                pos[left] = pos[i];
+                left++;
+            }
+        }
+        active = left;
     }
 }
 
@@ -607,12 +1859,27 @@ void AES256_CBC_init(AES256_CBC_ctx* ctx, const unsigned char* key16, const uint
     memcpy(ctx->iv, iv, 16);
 }
 
+void AES128_CBC_dec_init(AES128_CBC_dec_ctx* ctx, const unsigned char* key16, const uint8_t* iv) {
+    AES128_dec_init(&(ctx->ctx), key16);
+    memcpy(ctx->iv, iv, 16);
+}
+
+void AES192_CBC_dec_init(AES192_CBC_dec_ctx* ctx, const unsigned char* key16, const uint8_t* iv) {
+    AES192_dec_init(&(ctx->ctx), key16);
+    memcpy(ctx->iv, iv, 16);
+}
+
+void AES256_CBC_dec_init(AES256_CBC_dec_ctx* ctx, const unsigned char* key16, const uint8_t* iv) {
+    AES256_dec_init(&(ctx->ctx), key16);
+    memcpy(ctx->iv, iv, 16);
+}
+
 void AES128_CBC_encrypt(AES128_CBC_ctx* ctx, size_t blocks, unsigned char* encrypted, const unsigned char* plain) {
     AESCBC_encrypt(ctx->ctx.rk, ctx->iv, 10, blocks, encrypted, plain);
 }
 
 void AES128_CBC_decrypt(AES128_CBC_ctx* ctx, size_t blocks, unsigned char* plain, const unsigned char *encrypted) {
-    AESCBC_decrypt(ctx->ctx.rk, ctx->iv, 10, blocks, plain, encrypted);
+    AESCBC_decrypt(ctx->ctx.rk, NULL, 0, ctx->iv, 10, blocks, plain, encrypted);
 }
 
 void AES192_CBC_encrypt(AES192_CBC_ctx* ctx, size_t blocks, unsigned char* encrypted, const unsigned char* plain) {
@@ -620,7 +1887,7 @@ void AES192_CBC_encrypt(AES192_CBC_ctx* ctx, size_t blocks, unsigned char* encry
 }
 
 void AES192_CBC_decrypt(AES192_CBC_ctx* ctx, size_t blocks, unsigned char* plain, const unsigned char *encrypted) {
-    AESCBC_decrypt(ctx->ctx.rk, ctx->iv, 12, blocks, plain, encrypted);
+    AESCBC_decrypt(ctx->ctx.rk, NULL, 0, ctx->iv, 12, blocks, plain, encrypted);
 }
 
 void AES256_CBC_encrypt(AES256_CBC_ctx* ctx, size_t blocks, unsigned char* encrypted, const unsigned char* plain) {
@@ -628,5 +1895,333 @@ void AES256_CBC_encrypt(AES256_CBC_ctx* ctx, size_t blocks, unsigned char* encry
 }
 
 void AES256_CBC_decrypt(AES256_CBC_ctx* ctx, size_t blocks, unsigned char* plain, const unsigned char *encrypted) {
-    AESCBC_decrypt(ctx->ctx.rk, ctx->iv, 14, blocks, plain, encrypted);
+    AESCBC_decrypt(ctx->ctx.rk, NULL, 0, ctx->iv, 14, blocks, plain, encrypted);
+}
+
+void AES128_CBC_dec_decrypt(AES128_CBC_dec_ctx* ctx, size_t blocks, unsigned char* plain, const unsigned char *encrypted) {
+    AESCBC_decrypt(ctx->ctx.rk, ctx->ctx.rk_bytes[0], 1, ctx->iv, 10, blocks, plain, encrypted);
+}
+
+void AES192_CBC_dec_decrypt(AES192_CBC_dec_ctx* ctx, size_t blocks, unsigned char* plain, const unsigned char *encrypted) {
+    AESCBC_decrypt(ctx->ctx.rk, ctx->ctx.rk_bytes[0], 1, ctx->iv, 12, blocks, plain, encrypted);
+}
+
+void AES256_CBC_dec_decrypt(AES256_CBC_dec_ctx* ctx, size_t blocks, unsigned char* plain, const unsigned char *encrypted) {
+    AESCBC_decrypt(ctx->ctx.rk, ctx->ctx.rk_bytes[0], 1, ctx->iv, 14, blocks, plain, encrypted);
+}
+
+void AES128_CBC_encrypt_iv(const AES128_ctx* ctx, uint8_t* iv, size_t blocks, unsigned char* encrypted, const unsigned char* plain) {
+    AESCBC_encrypt(ctx->rk, iv, 10, blocks, encrypted, plain);
+}
+
+void AES128_CBC_decrypt_iv(const AES128_ctx* ctx, uint8_t* iv, size_t blocks, unsigned char* plain, const unsigned char *encrypted) {
+    AESCBC_decrypt(ctx->rk, NULL, 0, iv, 10, blocks, plain, encrypted);
+}
+
+void AES128_CBC_dec_decrypt_iv(const AES128_dec_ctx* ctx, uint8_t* iv, size_t blocks, unsigned char* plain, const unsigned char *encrypted) {
+    AESCBC_decrypt(ctx->rk, ctx->rk_bytes[0], 1, iv, 10, blocks, plain, encrypted);
+}
+
+void AES192_CBC_encrypt_iv(const AES192_ctx* ctx, uint8_t* iv, size_t blocks, unsigned char* encrypted, const unsigned char* plain) {
+    AESCBC_encrypt(ctx->rk, iv, 12, blocks, encrypted, plain);
+}
+
+void AES192_CBC_decrypt_iv(const AES192_ctx* ctx, uint8_t* iv, size_t blocks, unsigned char* plain, const unsigned char *encrypted) {
+    AESCBC_decrypt(ctx->rk, NULL, 0, iv, 12, blocks, plain, encrypted);
+}
+
+void AES192_CBC_dec_decrypt_iv(const AES192_dec_ctx* ctx, uint8_t* iv, size_t blocks, unsigned char* plain, const unsigned char *encrypted) {
+    AESCBC_decrypt(ctx->rk, ctx->rk_bytes[0], 1, iv, 12, blocks, plain, encrypted);
+}
+
+void AES256_CBC_encrypt_iv(const AES256_ctx* ctx, uint8_t* iv, size_t blocks, unsigned char* encrypted, const unsigned char* plain) {
+    AESCBC_encrypt(ctx->rk, iv, 14, blocks, encrypted, plain);
+}
+
+void AES256_CBC_decrypt_iv(const AES256_ctx* ctx, uint8_t* iv, size_t blocks, unsigned char* plain, const unsigned char *encrypted) {
+    AESCBC_decrypt(ctx->rk, NULL, 0, iv, 14, blocks, plain, encrypted);
+}
+
+void AES256_CBC_dec_decrypt_iv(const AES256_dec_ctx* ctx, uint8_t* iv, size_t blocks, unsigned char* plain, const unsigned char *encrypted) {
+    AESCBC_decrypt(ctx->rk, ctx->rk_bytes[0], 1, iv, 14, blocks, plain, encrypted);
+}
+
+void AES128_CBC_encrypt_streams(const AES128_ctx* ctx, size_t n, uint8_t* const* ivs, const size_t* blocks, unsigned char* const* encrypted, const unsigned char* const* plain) {
+    AESCBC_encrypt_streams(ctx->rk, 10, n, ivs, blocks, encrypted, plain);
+}
+
+void AES192_CBC_encrypt_streams(const AES192_ctx* ctx, size_t n, uint8_t* const* ivs, const size_t* blocks, unsigned char* const* encrypted, const unsigned char* const* plain) {
+    AESCBC_encrypt_streams(ctx->rk, 12, n, ivs, blocks, encrypted, plain);
+}
+
+void AES256_CBC_encrypt_streams(const AES256_ctx* ctx, size_t n, uint8_t* const* ivs, const size_t* blocks, unsigned char* const* encrypted, const unsigned char* const* plain) {
+    AESCBC_encrypt_streams(ctx->rk, 14, n, ivs, blocks, encrypted, plain);
+}
+
+/* The number of counter blocks AESCTR_crypt encrypts at once, a multiple of
+ * every backend's group. */
+#define CTR_CHUNK 64
+
+/* The number of blocks from which AESCTR_crypt computes the first round once
+ * per run of counter blocks (see AESCTR_crypt_runs). */
+#define CTR_RUNS_MIN 128
+
+/* The most runs of 256 counter blocks passed to encrypt_runs at once. */
+#define CTR_RUNS 16
+
+/* Add n to the big-endian counter in the last bytes bytes of ctr, without
+ * branches. */
+static void CTRAdd(uint8_t* ctr, unsigned int bytes, uint64_t n) {
+    unsigned int i, carry = 0;
+    for (i = 0; i < bytes; i++) {
+        carry += ctr[15 - i] + (unsigned int)(n & 0xff);
+        ctr[15 - i] = carry & 0xff;
+        carry >>= 8;
+        n >>= 8;
+    }
+}
+
+/* Counter blocks that only differ in their last byte agree after the first
+ * round, except in its first column: ShiftRows moves byte 15 there, and
+ * MixColumns then adds (s, s, 3s, 2s) to it, for s = S(byte ^ k[15]) with k
+ * the first round key. So every run of up to 256 consecutive counter blocks
+ * needs the first round only once, plus these S-box values, which are the
+ * same for all runs, and the blocks are encrypted from the second round on.
+ * Where runs start only depends on the counter, which is not secret.
+ *
+ * This saves a round for the bit sliced code, which is why the fixsliced
+ * kernel also supports an odd number of rounds. Partial rounds are no use
+ * there, as it computes SubBytes on all bytes at once either way, and the
+ * vector permute and AES-NI code is faster than the bytewise work this needs.
+ */
+
+/* Zero round keys for a single round, with which encryption computes
+ * ShiftRows(SubBytes(x)). */
+static const AES_state ctr_zero_rounds[2];
+static const unsigned char ctr_zero_rounds_bytes[32];
+
+/* Multiply a byte by x, as a polynomial over GF(2) mod x^8 + x^4 + x^3 + x + 1 */
+static unsigned char MultXByte(unsigned char x) {
+    return (unsigned char)((x << 1) ^ (0x1b & -(x >> 7)));
+}
+
+/** The backend that encrypts CTR_CHUNK blocks, if it is bit sliced code, else NULL. */
+static const AES_backend* CTRRunsBackend(void) {
+    AES_active local[NUM_BACKENDS + 2];
+    const AES_active* active = ActiveBackends(local);
+    while (active->min_blocks > CTR_CHUNK) {
+        active++;
+    }
+    if (active->backend->encrypt_lanes == NULL && active->backend != &backends[NUM_BACKENDS - 1]) {
+        return NULL;
+    }
+    return active->backend;
+}
+
+/** Set base to the first round up to MixColumns of the counter block ctr,
+ *  without the contribution of its last byte. sbox holds S(b ^ key[15]).
+ */
+static void CTRFirstRound(unsigned char* base, const AES_keys* first, const uint8_t* ctr, const unsigned char* key, const unsigned char* sbox) {
+    unsigned char s = sbox[ctr[15]], s2 = MultXByte(s);
+    int c;
+    for (c = 0; c < 16; c++) {
+        base[c] = ctr[c] ^ key[c];
+    }
+    AES_encrypt_keys(first, 1, base, base);
+    for (c = 0; c < 16; c += 4) {
+        unsigned char a0 = base[c], a1 = base[c + 1], a2 = base[c + 2], a3 = base[c + 3], t = a0 ^ a1 ^ a2 ^ a3;
+        base[c] = a0 ^ t ^ MultXByte(a0 ^ a1);
+        base[c + 1] = a1 ^ t ^ MultXByte(a1 ^ a2);
+        base[c + 2] = a2 ^ t ^ MultXByte(a2 ^ a3);
+        base[c + 3] = a3 ^ t ^ MultXByte(a3 ^ a0);
+    }
+    base[0] ^= s;
+    base[1] ^= s;
+    base[2] ^= s2 ^ s;
+    base[3] ^= s2;
+}
+
+/** CTR process blocks whole blocks, computing the first round once per run.
+ *  Whole runs of 256 blocks go to backend->encrypt_runs, if it has one, which
+ *  sets up the blocks after their first round directly in sliced form: the
+ *  state of the run in every block, plus the (s, s, 3s, 2s) columns, which
+ *  it only transposes once per call. The rest is done one chunk at a time,
+ *  setting up the blocks in bytes.
+ */
+static void AESCTR_crypt_runs(const AES_backend* backend, const AES_state* rounds, const unsigned char* rounds_bytes, int nk, AES_CTR_state* state, size_t blocks, unsigned char* out, const unsigned char* in) {
+    AES_keys keys, first;
+    unsigned char sbox[256], cols[256 * 4], bases[CTR_RUNS * 16], buf[CTR_CHUNK * 16];
+    size_t i;
+    int have_base = 0;
+
+    /* S(b ^ k[15]) for every b, which comes out of the single round in
+     * ShiftRows order: byte r of column c there is from column c + r. */
+    InitKeys(&first, ctr_zero_rounds, ctr_zero_rounds_bytes, 1);
+    for (i = 0; i < 256; i++) {
+        buf[i] = i ^ rounds_bytes[15];
+    }
+    AES_encrypt_keys(&first, 16, buf, buf);
+    for (i = 0; i < 256; i++) {
+        unsigned char s = buf[(i & ~15) | ((i - 4 * (i & 3)) & 12) | (i & 3)], s2 = MultXByte(s);
+        sbox[i] = s;
+        cols[4 * i] = s;
+        cols[4 * i + 1] = s;
+        cols[4 * i + 2] = s2 ^ s;
+        cols[4 * i + 3] = s2;
+    }
+
+    InitKeys(&keys, rounds + 1, rounds_bytes + 16, nk - 1);
+    while (blocks > 0) {
+        size_t n = blocks < CTR_CHUNK ? blocks : CTR_CHUNK;
+        if (backend->encrypt_runs) {
+            if (state->counter[15] == 0 && blocks >= 256) {
+                size_t runs = blocks / 256 < CTR_RUNS ? blocks / 256 : CTR_RUNS;
+                for (i = 0; i < runs; i++) {
+                    CTRFirstRound(bases + 16 * i, &first, state->counter, rounds_bytes, sbox);
+                    CTRAdd(state->counter, state->counter_bytes, 256);
+                }
+                backend->encrypt_runs(&keys, cols, bases, runs, out, in);
+                out += runs * 256 * 16;
+                in += runs * 256 * 16;
+                blocks -= runs * 256;
+                have_base = 0;
+                continue;
+            }
+            /* Stop at the end of the run, so the next one can be whole. */
+            if (n > (size_t)(256 - state->counter[15])) {
+                n = (size_t)(256 - state->counter[15]);
+            }
+        }
+        if (!have_base) {
+            CTRFirstRound(buf, &first, state->counter, rounds_bytes, sbox);
+            memcpy(bases, buf, 16);
+            have_base = 1;
+        }
+        for (i = 0; i < n; i++) {
+            memcpy(buf + i * 16, bases, 16);
+            buf[i * 16] ^= cols[4 * state->counter[15]];
+            buf[i * 16 + 1] ^= cols[4 * state->counter[15] + 1];
+            buf[i * 16 + 2] ^= cols[4 * state->counter[15] + 2];
+            buf[i * 16 + 3] ^= cols[4 * state->counter[15] + 3];
+            if (state->counter[15] == 0xff) {
+                /* Carry into the rest of the counter, starting a new run. */
+                CTRAdd(state->counter, state->counter_bytes, 1);
+                have_base = 0;
+                if (i + 1 < n) {
+                    CTRFirstRound(bases, &first, state->counter, rounds_bytes, sbox);
+                    have_base = 1;
+                }
+            } else {
+                state->counter[15]++;
+            }
+        }
+        AES_encrypt_keys(&keys, n, buf, buf);
+        for (i = 0; i < n * 16; i++) {
+            out[i] = in[i] ^ buf[i];
+        }
+        out += n * 16;
+        in += n * 16;
+        blocks -= n;
+    }
+}
+
+/* rounds_bytes may be NULL, in which case the round keys are converted to byte
+ * order here: the first round needs them, and so may the single block code for
+ * every chunk. */
+static void AESCTR_crypt(const AES_state* rounds, const unsigned char* rounds_bytes, int nk, AES_CTR_state* state, size_t len, unsigned char* out, const unsigned char* in) {
+    const AES_backend* backend;
+    AES_keys keys;
+    unsigned char buf[CTR_CHUNK * 16], bytes[15 * 16];
+
+    while (len > 0 && state->used < 16) {
+        *(out++) = *(in++) ^ state->keystream[state->used++];
+        len--;
+    }
+    if (len > 0 && rounds_bytes == NULL) {
+        LoadByteKeys(bytes, rounds, nk);
+        rounds_bytes = bytes;
+    }
+    if (len >= CTR_RUNS_MIN * 16 && (backend = CTRRunsBackend()) != NULL) {
+        size_t blocks = len / 16;
+        AESCTR_crypt_runs(backend, rounds, rounds_bytes, nk, state, blocks, out, in);
+        out += blocks * 16;
+        in += blocks * 16;
+        len -= blocks * 16;
+    }
+    InitKeys(&keys, rounds, rounds_bytes, nk);
+    while (len > 0) {
+        size_t i, blocks = len < CTR_CHUNK * 16 ? (len + 15) / 16 : CTR_CHUNK;
+        size_t bytes = len < blocks * 16 ? len : blocks * 16;
+        for (i = 0; i < blocks; i++) {
+            memcpy(buf + i * 16, state->counter, 16);
+            CTRAdd(state->counter, state->counter_bytes, 1);
+        }
+        AES_encrypt_keys(&keys, blocks, buf, buf);
+        for (i = 0; i < bytes; i++) {
+            out[i] = in[i] ^ buf[i];
+        }
+        if (bytes < blocks * 16) {
+            /* Keep the rest of the last block's keystream for the next call. */
+            memcpy(state->keystream, buf + (blocks - 1) * 16, 16);
+            state->used = bytes - (blocks - 1) * 16;
+        }
+        out += bytes;
+        in += bytes;
+        len -= bytes;
+    }
+}
+
+int AES_CTR_init(AES_CTR_state* state, const uint8_t* counter16, int counter_bits) {
+    if (counter_bits != 32 && counter_bits != 64 && counter_bits != 128) {
+        return 0;
+    }
+    memcpy(state->counter, counter16, 16);
+    memset(state->keystream, 0, 16);
+    state->used = 16;
+    state->counter_bytes = counter_bits / 8;
+    return 1;
+}
+
+/* CTR from byte offset onwards of the stream that starts at counter16, with
+ * all state on the stack: the counter block of that offset is computed
+ * directly, and the keystream before offset within it is skipped. */
+static int AESCTR_crypt_at(const AES_state* rounds, int nk, const uint8_t* counter16, int counter_bits, uint64_t offset, size_t len, unsigned char* out, const unsigned char* in) {
+    AES_CTR_state state;
+    unsigned char rounds_bytes[15 * 16];
+    if (!AES_CTR_init(&state, counter16, counter_bits)) {
+        return 0;
+    }
+    LoadByteKeys(rounds_bytes, rounds, nk);
+    CTRAdd(state.counter, state.counter_bytes, offset / 16);
+    if (offset % 16 != 0) {
+        AES_encrypt_blocks(rounds, rounds_bytes, nk, 1, state.keystream, state.counter);
+        CTRAdd(state.counter, state.counter_bytes, 1);
+        state.used = offset % 16;
+    }
+    AESCTR_crypt(rounds, rounds_bytes, nk, &state, len, out, in);
+    return 1;
+}
+
+void AES128_CTR_crypt(const AES128_ctx* ctx, AES_CTR_state* state, size_t len, unsigned char* out, const unsigned char* in) {
+    AESCTR_crypt(ctx->rk, NULL, 10, state, len, out, in);
+}
+
+void AES192_CTR_crypt(const AES192_ctx* ctx, AES_CTR_state* state, size_t len, unsigned char* out, const unsigned char* in) {
+    AESCTR_crypt(ctx->rk, NULL, 12, state, len, out, in);
+}
+
+void AES256_CTR_crypt(const AES256_ctx* ctx, AES_CTR_state* state, size_t len, unsigned char* out, const unsigned char* in) {
+    AESCTR_crypt(ctx->rk, NULL, 14, state, len, out, in);
+}
+
+int AES128_CTR_crypt_at(const AES128_ctx* ctx, const uint8_t* counter16, int counter_bits, uint64_t offset, size_t len, unsigned char* out, const unsigned char* in) {
+    return AESCTR_crypt_at(ctx->rk, 10, counter16, counter_bits, offset, len, out, in);
+}
+
+int AES192_CTR_crypt_at(const AES192_ctx* ctx, const uint8_t* counter16, int counter_bits, uint64_t offset, size_t len, unsigned char* out, const unsigned char* in) {
+    return AESCTR_crypt_at(ctx->rk, 12, counter16, counter_bits, offset, len, out, in);
+}
+
+int AES256_CTR_crypt_at(const AES256_ctx* ctx, const uint8_t* counter16, int counter_bits, uint64_t offset, size_t len, unsigned char* out, const unsigned char* in) {
+    return AESCTR_crypt_at(ctx->rk, 14, counter16, counter_bits, offset, len, out, in);
 }
@@ -26,6 +26,68 @@ typedef struct {
     AES_state rk[15];
 } AES256_ctx;
 
+/* Key schedules for decryption only, which also store the round keys in byte
+ * order for the Equivalent Inverse Cipher: in reverse order, with InvMixColumns
+ * applied to all but the first and last. This saves transforming them on every
+ * call where AES instructions are used, at twice the size. */
+typedef struct {
+    AES_state rk[11];
+    unsigned char rk_bytes[11][16]; /* the inverse cipher round keys, in byte order */
+} AES128_dec_ctx;
+
+typedef struct {
+    AES_state rk[13];
+    unsigned char rk_bytes[13][16]; /* the inverse cipher round keys, in byte order */
+} AES192_dec_ctx;
+
+typedef struct {
+    AES_state rk[15];
+    unsigned char rk_bytes[15][16]; /* the inverse cipher round keys, in byte order */
+} AES256_dec_ctx;
+
+/* Contexts that only store the key, and expand it into the key schedule on
+ * the fly, in every call. They are 7 to 22 times smaller than the ones above,
+ * but every call takes the time of a key setup extra. */
+typedef struct {
+    unsigned char key[16];
+} AES128_otf_ctx;
+
+typedef struct {
+    unsigned char key[24];
+} AES192_otf_ctx;
+
+typedef struct {
+    unsigned char key[32];
+} AES256_otf_ctx;
+
+/* Contexts that also store the round keys as prepared for the code that is
+ * used for the largest calls, chosen when they are set up, so that calls do
+ * not need to prepare them every time: in byte order for AES instructions, or
+ * spread over the blocks of the parallel code. This is done for code that
+ * takes up to 256 bytes per round key, aligned to 64 bytes within wide. When
+ * the context is copied to an address with another alignment, or other code
+ * is used, they work like the ones above. */
+typedef struct {
+    AES128_ctx ctx;
+    int wide_backend; /* which code the round keys in wide are for, 0 for none */
+    int wide_offset;  /* the address of wide modulo 64 when they were prepared */
+    unsigned char wide[11 * 256 + 63];
+} AES128_wide_ctx;
+
+typedef struct {
+    AES192_ctx ctx;
+    int wide_backend;
+    int wide_offset;
+    unsigned char wide[13 * 256 + 63];
+} AES192_wide_ctx;
+
+typedef struct {
+    AES256_ctx ctx;
+    int wide_backend;
+    int wide_offset;
+    unsigned char wide[15 * 256 + 63];
+} AES256_wide_ctx;
+
 typedef struct {
     AES128_ctx ctx;
     uint8_t iv[16]; /* iv is updated after each use */
@@ -41,18 +103,192 @@ typedef struct {
     uint8_t iv[16]; /* iv is updated after each use */
 } AES256_CBC_ctx;
 
+typedef struct {
+    AES128_dec_ctx ctx;
+    uint8_t iv[16]; /* iv is updated after each use */
+} AES128_CBC_dec_ctx;
+
+typedef struct {
+    AES192_dec_ctx ctx;
+    uint8_t iv[16]; /* iv is updated after each use */
+} AES192_CBC_dec_ctx;
+
+typedef struct {
+    AES256_dec_ctx ctx;
+    uint8_t iv[16]; /* iv is updated after each use */
+} AES256_CBC_dec_ctx;
+
+typedef struct {
+    uint8_t counter[16]; /* the next counter block */
+    unsigned char keystream[16]; /* keystream of the counter block before it */
+    unsigned int used; /* bytes of keystream already used, 16 if none are left */
+    unsigned int counter_bytes; /* the low counter_bytes bytes of counter are incremented */
+} AES_CTR_state;
+
+/** When portable is nonzero, only use the portable C code, and not the code
+ *  for instruction set extensions that is otherwise picked at runtime when the
+ *  CPU supports it (AES-NI, SSSE3, AVX2). Contexts remain valid either way.
+ *  Meant for testing; it must not be called concurrently with other calls.
+ */
+void AES_set_portable(int portable);
+
+/** Return the name of the i'th implementation that can be used on this CPU,
+ *  in order of preference, or NULL if there are not that many. Depending on
+ *  the platform, these are some of "aesni", "vector", "avx2x16", "sse2x8",
+ *  "bitslice64", "vperm", "fixslice32" and "scalar16".
+ */
+const char* AES_backend_name(size_t i);
+
+/** Use only the implementation called name, plus "scalar16" for the blocks
+ *  left over when it processes groups of blocks, or choose automatically again
+ *  when name is NULL. Without calls to this function, the CTAES_BACKEND
+ *  environment variable is used in the same way. Returns 0 (and changes
+ *  nothing) if name is not one of the names AES_backend_name returns, and 1
+ *  otherwise. Not to be called concurrently with other calls.
+ */
+int AES_set_backend(const char* name);
+
+/** Time the implementations that can be used on this CPU at various numbers
+ *  of blocks, and from then on choose between them based on the number of
+ *  blocks in each call, instead of always using the widest one that fits.
+ *  This takes some tens of milliseconds. When the CTAES_TUNING environment
+ *  variable names a file, the first call loads the tuning from that file, or
+ *  when that fails, tunes and saves the result there.
+ *  Not to be called concurrently with other calls.
+ */
+void AES_autotune(void);
+
+/** Choose between the implementations as AES_autotune would if a call to the
+ *  i'th one (in the order of AES_backend_name) with n blocks took
+ *  overhead[i] + n * per_block[i] seconds. Meant for testing; not to be
+ *  called concurrently with other calls.
+ */
+void AES_autotune_timings(const double* overhead, const double* per_block);
+
+/** Use the tuning saved by AES_autotune_save in the file at path. Returns 1
+ *  on success, and 0 (without changes) if it cannot be read, or does not
+ *  match what this CPU supports. Not to be called concurrently with other
+ *  calls.
+ */
+int AES_autotune_load(const char* path);
+
+/** Save the current tuning to the file at path. Returns 1 on success, and 0
+ *  if that fails or there is no tuning.
+ */
+int AES_autotune_save(const char* path);
+
+/** AES*_init_many(ctxs, n, keys) sets up ctxs[i] exactly like AES*_init with
+ *  the i'th key in keys (stored one after another), for every i < n. It
+ *  computes the key schedules of several keys at once, so it is faster when
+ *  setting up many contexts.
+ */
 void AES128_init(AES128_ctx* ctx, const unsigned char* key16);
+void AES128_init_many(AES128_ctx* ctxs, size_t n, const unsigned char* keys16);
 void AES128_encrypt(const AES128_ctx* ctx, size_t blocks, unsigned char* cipher16, const unsigned char* plain16);
 void AES128_decrypt(const AES128_ctx* ctx, size_t blocks, unsigned char* plain16, const unsigned char* cipher16);
 
 void AES192_init(AES192_ctx* ctx, const unsigned char* key24);
+void AES192_init_many(AES192_ctx* ctxs, size_t n, const unsigned char* keys24);
 void AES192_encrypt(const AES192_ctx* ctx, size_t blocks, unsigned char* cipher16, const unsigned char* plain16);
 void AES192_decrypt(const AES192_ctx* ctx, size_t blocks, unsigned char* plain16, const unsigned char* cipher16);
 
 void AES256_init(AES256_ctx* ctx, const unsigned char* key32);
+void AES256_init_many(AES256_ctx* ctxs, size_t n, const unsigned char* keys32);
 void AES256_encrypt(const AES256_ctx* ctx, size_t blocks, unsigned char* cipher16, const unsigned char* plain16);
 void AES256_decrypt(const AES256_ctx* ctx, size_t blocks, unsigned char* plain16, const unsigned char* cipher16);
 
+/** AES*_encrypt_many(ctxs, n, cipher16, plain16) does the same as
+ *  AES*_encrypt(ctxs[i], 1, cipher16[i], plain16[i]) for every i < n, and
+ *  AES*_decrypt_many likewise, but processes the blocks of different
+ *  contexts in parallel, as if they were consecutive blocks of one call.
+ */
+void AES128_encrypt_many(const AES128_ctx* const* ctxs, size_t n, unsigned char* const* cipher16, const unsigned char* const* plain16);
+void AES128_decrypt_many(const AES128_ctx* const* ctxs, size_t n, unsigned char* const* plain16, const unsigned char* const* cipher16);
+
+void AES192_encrypt_many(const AES192_ctx* const* ctxs, size_t n, unsigned char* const* cipher16, const unsigned char* const* plain16);
+void AES192_decrypt_many(const AES192_ctx* const* ctxs, size_t n, unsigned char* const* plain16, const unsigned char* const* cipher16);
+
+void AES256_encrypt_many(const AES256_ctx* const* ctxs, size_t n, unsigned char* const* cipher16, const unsigned char* const* plain16);
+void AES256_decrypt_many(const AES256_ctx* const* ctxs, size_t n, unsigned char* const* plain16, const unsigned char* const* cipher16);
+
+/** The *_dec_* functions decrypt exactly like the corresponding ones above,
+ *  but with a context that can only decrypt, set up by *_dec_init.
+ */
+void AES128_dec_init(AES128_dec_ctx* ctx, const unsigned char* key16);
+void AES128_dec_decrypt(const AES128_dec_ctx* ctx, size_t blocks, unsigned char* plain16, const unsigned char* cipher16);
+
+void AES192_dec_init(AES192_dec_ctx* ctx, const unsigned char* key24);
+void AES192_dec_decrypt(const AES192_dec_ctx* ctx, size_t blocks, unsigned char* plain16, const unsigned char* cipher16);
+
+void AES256_dec_init(AES256_dec_ctx* ctx, const unsigned char* key32);
+void AES256_dec_decrypt(const AES256_dec_ctx* ctx, size_t blocks, unsigned char* plain16, const unsigned char* cipher16);
+
+/** The *_otf_* functions encrypt and decrypt exactly like the corresponding
+ *  ones above, but with a context set up by *_otf_init.
+ */
+void AES128_otf_init(AES128_otf_ctx* ctx, const unsigned char* key16);
+void AES128_otf_encrypt(const AES128_otf_ctx* ctx, size_t blocks, unsigned char* cipher16, const unsigned char* plain16);
+void AES128_otf_decrypt(const AES128_otf_ctx* ctx, size_t blocks, unsigned char* plain16, const unsigned char* cipher16);
+
+void AES192_otf_init(AES192_otf_ctx* ctx, const unsigned char* key24);
+void AES192_otf_encrypt(const AES192_otf_ctx* ctx, size_t blocks, unsigned char* cipher16, const unsigned char* plain16);
+void AES192_otf_decrypt(const AES192_otf_ctx* ctx, size_t blocks, unsigned char* plain16, const unsigned char* cipher16);
+
+void AES256_otf_init(AES256_otf_ctx* ctx, const unsigned char* key32);
+void AES256_otf_encrypt(const AES256_otf_ctx* ctx, size_t blocks, unsigned char* cipher16, const unsigned char* plain16);
+void AES256_otf_decrypt(const AES256_otf_ctx* ctx, size_t blocks, unsigned char* plain16, const unsigned char* cipher16);
+
+/** The *_wide_* functions encrypt and decrypt exactly like the corresponding
+ *  ones above, but with a context set up by *_wide_init.
+ */
+void AES128_wide_init(AES128_wide_ctx* ctx, const unsigned char* key16);
+void AES128_wide_encrypt(const AES128_wide_ctx* ctx, size_t blocks, unsigned char* cipher16, const unsigned char* plain16);
+void AES128_wide_decrypt(const AES128_wide_ctx* ctx, size_t blocks, unsigned char* plain16, const unsigned char* cipher16);
+
+void AES192_wide_init(AES192_wide_ctx* ctx, const unsigned char* key24);
+void AES192_wide_encrypt(const AES192_wide_ctx* ctx, size_t blocks, unsigned char* cipher16, const unsigned char* plain16);
+void AES192_wide_decrypt(const AES192_wide_ctx* ctx, size_t blocks, unsigned char* plain16, const unsigned char* cipher16);
+
+void AES256_wide_init(AES256_wide_ctx* ctx, const unsigned char* key32);
+void AES256_wide_encrypt(const AES256_wide_ctx* ctx, size_t blocks, unsigned char* cipher16, const unsigned char* plain16);
+void AES256_wide_decrypt(const AES256_wide_ctx* ctx, size_t blocks, unsigned char* plain16, const unsigned char* cipher16);
+
+/** Key stores hold an array of contexts in a fixed format, so they can be
+ *  built once (for example into a file) and later be used in place (for
+ *  example memory mapped from that file) without any key setup.
+ *
+ *  The format is a 32-byte header followed by the n contexts, exactly as
+ *  AES*_init sets them up, with the 16-bit slices little endian:
+ *    bytes 0-7    the magic "ctaesks\0"
+ *    bytes 8-11   the format version, 2, as 32-bit little endian integer
+ *    bytes 12-15  the key size in bits (128, 192 or 256), likewise
+ *    bytes 16-23  n, as 64-bit little endian integer
+ *    bytes 24-31  a 64-bit checksum of all other bytes, see ctaes.c
+ *  They are only supported on little endian platforms.
+ *
+ *  AES*_keystore_size returns the size of a store with n contexts.
+ *  AES*_keystore_build sets up a store with n contexts for the keys in keys
+ *  (stored one after another) at store, which must have that size, and be
+ *  aligned like the contexts. It returns 0 on big endian platforms, and 1
+ *  otherwise.
+ *  AES*_keystore_open checks the store of len bytes at store, and returns its
+ *  contexts, setting *n to their number. It returns NULL, and sets *n to 0,
+ *  if store is not aligned like the contexts, not a valid store of this key
+ *  size, or has a different length. This reads the whole store once, to
+ *  verify the checksum.
+ */
+size_t AES128_keystore_size(size_t n);
+int AES128_keystore_build(unsigned char* store, size_t n, const unsigned char* keys16);
+const AES128_ctx* AES128_keystore_open(const unsigned char* store, size_t len, size_t* n);
+
+size_t AES192_keystore_size(size_t n);
+int AES192_keystore_build(unsigned char* store, size_t n, const unsigned char* keys24);
+const AES192_ctx* AES192_keystore_open(const unsigned char* store, size_t len, size_t* n);
+
+size_t AES256_keystore_size(size_t n);
+int AES256_keystore_build(unsigned char* store, size_t n, const unsigned char* keys32);
+const AES256_ctx* AES256_keystore_open(const unsigned char* store, size_t len, size_t* n);
+
 void AES128_CBC_init(AES128_CBC_ctx* ctx, const unsigned char* key16, const uint8_t* iv);
 void AES128_CBC_encrypt(AES128_CBC_ctx* ctx, size_t blocks, unsigned char* encrypted, const unsigned char* plain);
 void AES128_CBC_decrypt(AES128_CBC_ctx* ctx, size_t blocks, unsigned char* plain, const unsigned char *encrypted);
@@ -65,4 +301,70 @@ void AES256_CBC_init(AES256_CBC_ctx* ctx, const unsigned char* key16, const uint
 void AES256_CBC_encrypt(AES256_CBC_ctx* ctx, size_t blocks, unsigned char* encrypted, const unsigned char* plain);
 void AES256_CBC_decrypt(AES256_CBC_ctx* ctx, size_t blocks, unsigned char* plain, const unsigned char *encrypted);
 
+void AES128_CBC_dec_init(AES128_CBC_dec_ctx* ctx, const unsigned char* key16, const uint8_t* iv);
+void AES128_CBC_dec_decrypt(AES128_CBC_dec_ctx* ctx, size_t blocks, unsigned char* plain, const unsigned char *encrypted);
+
+void AES192_CBC_dec_init(AES192_CBC_dec_ctx* ctx, const unsigned char* key16, const uint8_t* iv);
+void AES192_CBC_dec_decrypt(AES192_CBC_dec_ctx* ctx, size_t blocks, unsigned char* plain, const unsigned char *encrypted);
+
+void AES256_CBC_dec_init(AES256_CBC_dec_ctx* ctx, const unsigned char* key16, const uint8_t* iv);
+void AES256_CBC_dec_decrypt(AES256_CBC_dec_ctx* ctx, size_t blocks, unsigned char* plain, const unsigned char *encrypted);
+
+/** The *_iv functions do the same as the CBC functions above, but with a
+ *  context that only holds the key schedule, and the iv (updated after each
+ *  use) passed separately. So one context can be shared by many streams, and
+ *  by many threads, each with their own iv.
+ */
+void AES128_CBC_encrypt_iv(const AES128_ctx* ctx, uint8_t* iv, size_t blocks, unsigned char* encrypted, const unsigned char* plain);
+void AES128_CBC_decrypt_iv(const AES128_ctx* ctx, uint8_t* iv, size_t blocks, unsigned char* plain, const unsigned char *encrypted);
+void AES128_CBC_dec_decrypt_iv(const AES128_dec_ctx* ctx, uint8_t* iv, size_t blocks, unsigned char* plain, const unsigned char *encrypted);
+
+void AES192_CBC_encrypt_iv(const AES192_ctx* ctx, uint8_t* iv, size_t blocks, unsigned char* encrypted, const unsigned char* plain);
+void AES192_CBC_decrypt_iv(const AES192_ctx* ctx, uint8_t* iv, size_t blocks, unsigned char* plain, const unsigned char *encrypted);
+void AES192_CBC_dec_decrypt_iv(const AES192_dec_ctx* ctx, uint8_t* iv, size_t blocks, unsigned char* plain, const unsigned char *encrypted);
+
+void AES256_CBC_encrypt_iv(const AES256_ctx* ctx, uint8_t* iv, size_t blocks, unsigned char* encrypted, const unsigned char* plain);
+void AES256_CBC_decrypt_iv(const AES256_ctx* ctx, uint8_t* iv, size_t blocks, unsigned char* plain, const unsigned char *encrypted);
+void AES256_CBC_dec_decrypt_iv(const AES256_dec_ctx* ctx, uint8_t* iv, size_t blocks, unsigned char* plain, const unsigned char *encrypted);
+
+/** CBC encrypt n independent streams under the same key at once. Stream i
+ *  encrypts blocks[i] blocks from plain[i] to encrypted[i] (which may be the
+ *  same), with its own iv ivs[i], updated as by AES*_CBC_encrypt_iv. As each
+ *  stream can only encrypt a block after the one before it, the streams are
+ *  advanced together, one block of each per step, so that the parallel code
+ *  can still be used. Streams drop out as they finish, and waiting ones take
+ *  their place. Different streams must not overlap.
+ */
+void AES128_CBC_encrypt_streams(const AES128_ctx* ctx, size_t n, uint8_t* const* ivs, const size_t* blocks, unsigned char* const* encrypted, const unsigned char* const* plain);
+void AES192_CBC_encrypt_streams(const AES192_ctx* ctx, size_t n, uint8_t* const* ivs, const size_t* blocks, unsigned char* const* encrypted, const unsigned char* const* plain);
+void AES256_CBC_encrypt_streams(const AES256_ctx* ctx, size_t n, uint8_t* const* ivs, const size_t* blocks, unsigned char* const* encrypted, const unsigned char* const* plain);
+
+/** Start CTR mode at the counter block counter16, of which the last
+ *  counter_bits bits (32, 64 or 128) are a big-endian counter, incremented
+ *  (and wrapping around) after each block. Returns 1 on success, and 0
+ *  (leaving state untouched, so it must not be used) if counter_bits is any
+ *  other value. The state is separate from the context, so one context can
+ *  serve many streams.
+ */
+int AES_CTR_init(AES_CTR_state* state, const uint8_t* counter16, int counter_bits);
+
+/** CTR encrypt or decrypt len bytes (any number) from in to out (which may be
+ *  the same). Keystream left over from a partial block is used by the next
+ *  call on the same state.
+ */
+void AES128_CTR_crypt(const AES128_ctx* ctx, AES_CTR_state* state, size_t len, unsigned char* out, const unsigned char* in);
+void AES192_CTR_crypt(const AES192_ctx* ctx, AES_CTR_state* state, size_t len, unsigned char* out, const unsigned char* in);
+void AES256_CTR_crypt(const AES256_ctx* ctx, AES_CTR_state* state, size_t len, unsigned char* out, const unsigned char* in);
+
+/** CTR encrypt or decrypt len bytes from in to out, starting at byte offset
+ *  of the stream that AES_CTR_init(state, counter16, counter_bits) would
+ *  start, without generating the keystream before it. No state is kept, so
+ *  different threads can process different parts of one stream at once,
+ *  sharing one context. Returns 1 on success, and 0 (without writing to out)
+ *  if counter_bits is not 32, 64 or 128.
+ */
+int AES128_CTR_crypt_at(const AES128_ctx* ctx, const uint8_t* counter16, int counter_bits, uint64_t offset, size_t len, unsigned char* out, const unsigned char* in);
+int AES192_CTR_crypt_at(const AES192_ctx* ctx, const uint8_t* counter16, int counter_bits, uint64_t offset, size_t len, unsigned char* out, const unsigned char* in);
+int AES256_CTR_crypt_at(const AES256_ctx* ctx, const uint8_t* counter16, int counter_bits, uint64_t offset, size_t len, unsigned char* out, const unsigned char* in);
+
 #endif /* CTAES_H */
@@ -0,0 +1,928 @@
+ /*********************************************************************
+ * Copyright (c) 2016 Pieter Wuille                                   *
+ * Distributed under the MIT software license, see the accompanying   *
+ * file COPYING or https://opensource.org/licenses/mit-license.php.   *
+ **********************************************************************/
+
+/* Bit sliced AES round functions, generic over the width of a slice.
+ *
+ * This file is included by ctaes.c once per slice width. Before including it,
+ * define:
+ *   SLICE_T          The type of one bit slice: an unsigned integer, or a
+ *                    vector of unsigned integers.
+ *   SLICE_ELEM_T     The unsigned integer type of one element of SLICE_T.
+ *   SLICE_ELEMS      The number of elements in SLICE_T (1 for integers).
+ *   SLICE_ELEM(x,e)  An lvalue for element e of slice x.
+ *   SLICE_LANES      The number of blocks interleaved in one element. Every
+ *                    element is 16 * SLICE_LANES bits wide.
+ *   STATE_T          A struct type with a member SLICE_T slice[8].
+ *   BS(name)         The name to give to the generated function called name.
+ * and optionally:
+ *   SLICE_TARGET     Attributes for every generated function, for example to
+ *                    compile them for an instruction set extension.
+ *   SLICE_FIXSLICED  Use semi-fixsliced rounds in AES_encrypt and AES_decrypt
+ *                    (see below), with round keys to match.
+ * They are undefined again at the end of this file.
+ *
+ * A state holds SLICE_ELEMS * SLICE_LANES blocks. The 16 * SLICE_LANES bits of
+ * an element are split in 16 groups of SLICE_LANES bits, one per position in
+ * the 4x4 AES state (see ctaes.c), and block l of that element uses bit l of
+ * every group. Thanks to this interleaving, moving bytes around in the state
+ * is a shift or rotation of whole elements, exactly as it is for a single
+ * block in a 16-bit slice.
+ */
+
+#define BLOCKS (SLICE_ELEMS * SLICE_LANES)
+
+#ifndef SLICE_TARGET
+#define SLICE_TARGET
+#endif
+
+/* Loading and saving transposes the data with delta swaps of whole words, as
+ * in for example https://eprint.iacr.org/2020/1123.pdf, rather than moving
+ * every bit separately.
+ *
+ * Every element covers 16 * SLICE_LANES bytes, which are read as 8 little
+ * endian words of the element's width. Ortho below transposes the bits within
+ * each byte with the word index, so that slice b holds bit b of every byte, at
+ * index 8 * m + w for byte m of word w. Picking the word order (WORD_UNIT)
+ * well, at most three more delta swaps (FixIndex) then move each bit to its
+ * index (r * 4 + c) * SLICE_LANES + l for block l.
+ */
+
+/** Replicate the byte x over all bytes of an element */
+#define REPEAT8(x) (((SLICE_ELEM_T)-1 / 0xFF) * (x))
+
+/** Swap the bits of a at positions m << n with the bits of b at positions m */
+#define SWAPMOVE(a,b,m,n) do { \
+    SLICE_T t_ = (((a) >> (n)) ^ (b)) & (m); \
+    (b) ^= t_; \
+    (a) ^= t_ << (n); \
+} while (0)
+
+/** Swap the bits of x at positions m << n with those at positions m */
+#define DELTASWAP(x,m,n) do { \
+    SLICE_T t_ = ((x) ^ ((x) >> (n))) & (m); \
+    (x) ^= t_ ^ (t_ << (n)); \
+} while (0)
+
+#if SLICE_LANES == 2
+#define WORD_UNIT(w) ((((w) & 1) << 2) | ((w) >> 1))
+#else
+#define WORD_UNIT(w) ((((w) & 3) << 1) | ((w) >> 2))
+#endif
+
+/** Transpose the low 3 bits of every index of the 8 slices with the slice number (an involution) */
+static SLICE_TARGET void BS(Ortho)(STATE_T* s) {
+    SWAPMOVE(s->slice[0], s->slice[1], REPEAT8(0x55), 1);
+    SWAPMOVE(s->slice[2], s->slice[3], REPEAT8(0x55), 1);
+    SWAPMOVE(s->slice[4], s->slice[5], REPEAT8(0x55), 1);
+    SWAPMOVE(s->slice[6], s->slice[7], REPEAT8(0x55), 1);
+    SWAPMOVE(s->slice[0], s->slice[2], REPEAT8(0x33), 2);
+    SWAPMOVE(s->slice[1], s->slice[3], REPEAT8(0x33), 2);
+    SWAPMOVE(s->slice[4], s->slice[6], REPEAT8(0x33), 2);
+    SWAPMOVE(s->slice[5], s->slice[7], REPEAT8(0x33), 2);
+    SWAPMOVE(s->slice[0], s->slice[4], REPEAT8(0x0F), 4);
+    SWAPMOVE(s->slice[1], s->slice[5], REPEAT8(0x0F), 4);
+    SWAPMOVE(s->slice[2], s->slice[6], REPEAT8(0x0F), 4);
+    SWAPMOVE(s->slice[3], s->slice[7], REPEAT8(0x0F), 4);
+}
+
+/** Move the bits of every slice from their index after Ortho to their index in the state, or back if inv */
+static SLICE_TARGET void BS(FixIndex)(STATE_T* s, int inv) {
+#if SLICE_LANES == 1
+    int b;
+    (void)inv;
+    for (b = 0; b < 8; b++) {
+        DELTASWAP(s->slice[b], 0x00F0, 4);
+    }
+#elif SLICE_LANES == 4
+    int b;
+    for (b = 0; b < 8; b++) {
+        if (inv) {
+            DELTASWAP(s->slice[b], 0x00000000FFFF0000, 16);
+            DELTASWAP(s->slice[b], 0x00000000FF00FF00, 24);
+            DELTASWAP(s->slice[b], 0x00000000F0F0F0F0, 28);
+        } else {
+            DELTASWAP(s->slice[b], 0x00000000F0F0F0F0, 28);
+            DELTASWAP(s->slice[b], 0x00000000FF00FF00, 24);
+            DELTASWAP(s->slice[b], 0x00000000FFFF0000, 16);
+        }
+    }
+#elif SLICE_LANES == 2
+    /* With this word order, Ortho leaves every bit at the right index already. */
+    (void)s;
+    (void)inv;
+#else
+#error "Unsupported SLICE_LANES"
+#endif
+}
+
+/** Load BLOCKS * 16 bytes of data into 8 sliced integers */
+static SLICE_TARGET void BS(LoadBytes)(STATE_T *s, const unsigned char* data) {
+    /* Build the elements separately, as accessing individual vector elements is slow. */
+    SLICE_ELEM_T elems[8][SLICE_ELEMS];
+    int e;
+    for (e = 0; e < SLICE_ELEMS; e++) {
+        int w;
+        for (w = 0; w < 8; w++) {
+            const unsigned char* p = data + (e * 8 + WORD_UNIT(w)) * sizeof(SLICE_ELEM_T);
+            SLICE_ELEM_T x = 0;
+            int i;
+            for (i = sizeof(SLICE_ELEM_T) - 1; i >= 0; i--) {
+                x = (x << 8) | p[i];
+            }
+            elems[w][e] = x;
+        }
+    }
+    memcpy(s->slice, elems, sizeof(elems));
+    BS(Ortho)(s);
+    BS(FixIndex)(s, 0);
+}
+
+/** Convert 8 sliced integers into BLOCKS * 16 bytes of data */
+static SLICE_TARGET void BS(SaveBytes)(unsigned char* data, const STATE_T *s) {
+    SLICE_ELEM_T elems[8][SLICE_ELEMS];
+    STATE_T t = *s;
+    int e;
+    BS(FixIndex)(&t, 1);
+    BS(Ortho)(&t);
+    memcpy(elems, t.slice, sizeof(elems));
+    for (e = 0; e < SLICE_ELEMS; e++) {
+        int w;
+        for (w = 0; w < 8; w++) {
+            unsigned char* p = data + (e * 8 + WORD_UNIT(w)) * sizeof(SLICE_ELEM_T);
+            SLICE_ELEM_T x = elems[w][e];
+            int i;
+            for (i = 0; i < (int)sizeof(SLICE_ELEM_T); i++) {
+                p[i] = x;
+                x >>= 8;
+            }
+        }
+    }
+}
+
+#if BLOCKS > 1
+/** Spread the 16 bits of a single block slice x over an element, SLICE_LANES apart, as block 0 of it */
+static SLICE_TARGET uint64_t BS(SpreadSlice)(uint64_t x) {
+#if SLICE_LANES == 4
+    x = (x | (x << 24)) & 0x000000FF000000FF;
+    x = (x | (x << 12)) & 0x000F000F000F000F;
+    x = (x | (x << 6)) & 0x0303030303030303;
+    x = (x | (x << 3)) & 0x1111111111111111;
+#elif SLICE_LANES == 2
+    x = (x | (x << 8)) & 0x00FF00FF;
+    x = (x | (x << 4)) & 0x0F0F0F0F;
+    x = (x | (x << 2)) & 0x33333333;
+    x = (x | (x << 1)) & 0x55555555;
+#elif SLICE_LANES != 1
+#error "Unsupported SLICE_LANES"
+#endif
+    return x;
+}
+
+/** Copy the single block state in (typically a round key) into every block of s */
+static SLICE_TARGET void BS(LoadKey)(STATE_T* s, const AES_state* in) {
+    int b;
+    for (b = 0; b < 8; b++) {
+        /* Copy every bit to its SLICE_LANES - 1 neighbours. */
+        uint64_t x = BS(SpreadSlice)(in->slice[b]) * ((1 << SLICE_LANES) - 1);
+        {
+            int e;
+            for (e = 0; e < SLICE_ELEMS; e++) {
+                SLICE_ELEM(s->slice[b], e) = x;
+            }
+        }
+    }
+}
+#endif
+
+/* S-box implementations based on the 115 gate circuit for the forward S-box from:
+ *   Joan Boyar and Rene Peralta, A new combinational logic minimization
+ *   technique with applications to cryptology.
+ *   https://eprint.iacr.org/2009/191.pdf
+ *
+ * Its middle part inverts in GF(2^8), given 22 linear combinations Y0..Y21 of
+ * the input bits, producing 18 values Z0..Z17 that the output bits are linear
+ * combinations of. The forward S-box uses the circuit as published. The
+ * inverse S-box uses the same middle part, with the inverse of the affine map
+ * composed into the linear parts around it (which were then minimized again),
+ * so that neither direction pays for the other's linear layers.
+ */
+/** The non-linear middle part of the circuit: compute Z0..Z17 from Y0..Y21 */
+#define SBOX_MIDDLE do { \
+    SLICE_T T2, T3, T4, T5, T6, T7, T8, T9, T10, T11, T12, T13, T14, T15, T16, T17, T18; \
+    SLICE_T T19, T20, T21, T22, T23, T24, T25, T26, T27, T28, T29, T30, T31, T32, T33; \
+    SLICE_T T34, T35, T36, T37, T38, T39, T40, T41, T42, T43, T44, T45; \
+    T2 = Y12 & Y15; \
+    T3 = Y3 & Y6; \
+    T4 = T3 ^ T2; \
+    T5 = Y4 & Y0; \
+    T6 = T5 ^ T2; \
+    T7 = Y13 & Y16; \
+    T8 = Y5 & Y1; \
+    T9 = T8 ^ T7; \
+    T10 = Y2 & Y7; \
+    T11 = T10 ^ T7; \
+    T12 = Y9 & Y11; \
+    T13 = Y14 & Y17; \
+    T14 = T13 ^ T12; \
+    T15 = Y8 & Y10; \
+    T16 = T15 ^ T12; \
+    T17 = T4 ^ T14; \
+    T18 = T6 ^ T16; \
+    T19 = T9 ^ T14; \
+    T20 = T11 ^ T16; \
+    T21 = T17 ^ Y20; \
+    T22 = T18 ^ Y19; \
+    T23 = T19 ^ Y21; \
+    T24 = T20 ^ Y18; \
+    T25 = T21 ^ T22; \
+    T26 = T21 & T23; \
+    T27 = T24 ^ T26; \
+    T28 = T25 & T27; \
+    T29 = T28 ^ T22; \
+    T30 = T23 ^ T24; \
+    T31 = T22 ^ T26; \
+    T32 = T31 & T30; \
+    T33 = T32 ^ T24; \
+    T34 = T23 ^ T33; \
+    T35 = T27 ^ T33; \
+    T36 = T24 & T35; \
+    T37 = T36 ^ T34; \
+    T38 = T27 ^ T36; \
+    T39 = T29 & T38; \
+    T40 = T25 ^ T39; \
+    T41 = T40 ^ T37; \
+    T42 = T29 ^ T33; \
+    T43 = T29 ^ T40; \
+    T44 = T33 ^ T37; \
+    T45 = T42 ^ T41; \
+    Z0 = T44 & Y15; \
+    Z1 = T37 & Y6; \
+    Z2 = T33 & Y0; \
+    Z3 = T43 & Y16; \
+    Z4 = T40 & Y1; \
+    Z5 = T29 & Y7; \
+    Z6 = T42 & Y11; \
+    Z7 = T45 & Y17; \
+    Z8 = T41 & Y10; \
+    Z9 = T44 & Y12; \
+    Z10 = T37 & Y3; \
+    Z11 = T33 & Y4; \
+    Z12 = T43 & Y13; \
+    Z13 = T40 & Y5; \
+    Z14 = T29 & Y2; \
+    Z15 = T42 & Y9; \
+    Z16 = T45 & Y14; \
+    Z17 = T41 & Y8; \
+} while (0)
+
+/** Apply the AES S-box to every byte */
+static SLICE_TARGET void BS(SubBytes_fwd)(STATE_T *s) {
+    /* Load the bit slices */
+    SLICE_T X0 = s->slice[7], X1 = s->slice[6], X2 = s->slice[5], X3 = s->slice[4];
+    SLICE_T X4 = s->slice[3], X5 = s->slice[2], X6 = s->slice[1], X7 = s->slice[0];
+    SLICE_T Y0, Y1, Y2, Y3, Y4, Y5, Y6, Y7, Y8, Y9, Y10, Y11, Y12, Y13, Y14, Y15, Y16;
+    SLICE_T Y17, Y18, Y19, Y20, Y21;
+    SLICE_T Z0, Z1, Z2, Z3, Z4, Z5, Z6, Z7, Z8, Z9, Z10, Z11, Z12, Z13, Z14, Z15, Z16;
+    SLICE_T Z17;
+    SLICE_T T0, T1, T46, T47, T48, T49, T50, T51, T52, T53, T54, T55, T56, T57, T58, T59;
+    SLICE_T T60, T61, T62, T63, T64, T65, T66, T67;
+    SLICE_T S3;
+
+    /* Top linear transformation */
+    Y0 = X7;
+    Y14 = X3 ^ X5;
+    Y13 = X0 ^ X6;
+    Y9 = X0 ^ X3;
+    Y8 = X0 ^ X5;
+    T0 = X1 ^ X2;
+    Y1 = T0 ^ X7;
+    Y4 = Y1 ^ X3;
+    Y12 = Y13 ^ Y14;
+    Y2 = Y1 ^ X0;
+    Y5 = Y1 ^ X6;
+    Y3 = Y5 ^ Y8;
+    T1 = X4 ^ Y12;
+    Y15 = T1 ^ X5;
+    Y20 = T1 ^ X1;
+    Y6 = Y15 ^ X7;
+    Y10 = Y15 ^ T0;
+    Y11 = Y20 ^ Y9;
+    Y7 = X7 ^ Y11;
+    Y17 = Y10 ^ Y11;
+    Y19 = Y10 ^ Y8;
+    Y16 = T0 ^ Y11;
+    Y21 = Y13 ^ Y16;
+    Y18 = X0 ^ Y16;
+
+    SBOX_MIDDLE;
+
+    /* Bottom linear transformation, including the affine constant 0x63 */
+    T46 = Z15 ^ Z16;
+    T47 = Z10 ^ Z11;
+    T48 = Z5 ^ Z13;
+    T49 = Z9 ^ Z10;
+    T50 = Z2 ^ Z12;
+    T51 = Z2 ^ Z5;
+    T52 = Z7 ^ Z8;
+    T53 = Z0 ^ Z3;
+    T54 = Z6 ^ Z7;
+    T55 = Z16 ^ Z17;
+    T56 = Z12 ^ T48;
+    T57 = T50 ^ T53;
+    T58 = Z4 ^ T46;
+    T59 = Z3 ^ T54;
+    T60 = T46 ^ T57;
+    T61 = Z14 ^ T57;
+    T62 = T52 ^ T58;
+    T63 = T49 ^ T58;
+    T64 = Z4 ^ T59;
+    T65 = T61 ^ T62;
+    T66 = Z1 ^ T63;
+    s->slice[7] = T59 ^ T63;
+    s->slice[1] = ~(T56 ^ T62);
+    s->slice[0] = ~(T48 ^ T60);
+    T67 = T64 ^ T65;
+    S3 = T53 ^ T66;
+    s->slice[3] = T51 ^ T66;
+    s->slice[2] = T47 ^ T65;
+    s->slice[6] = ~(T64 ^ S3);
+    s->slice[5] = ~(T55 ^ T67);
+    s->slice[4] = S3;
+}
+
+/** Apply the inverse AES S-box to every byte */
+static SLICE_TARGET void BS(SubBytes_inv)(STATE_T *s) {
+    /* Load the bit slices, and undo the affine constant 0x63 */
+    SLICE_T X0 = s->slice[7], X1 = ~s->slice[6], X2 = ~s->slice[5], X3 = s->slice[4];
+    SLICE_T X4 = s->slice[3], X5 = s->slice[2], X6 = ~s->slice[1], X7 = ~s->slice[0];
+    SLICE_T Y0, Y1, Y2, Y3, Y4, Y5, Y6, Y7, Y8, Y9, Y10, Y11, Y12, Y13, Y14, Y15, Y16;
+    SLICE_T Y17, Y18, Y19, Y20, Y21;
+    SLICE_T Z0, Z1, Z2, Z3, Z4, Z5, Z6, Z7, Z8, Z9, Z10, Z11, Z12, Z13, Z14, Z15, Z16;
+    SLICE_T Z17;
+    SLICE_T R0, W0, W1, W2, W3, W4, W5, W6, W7, W8, W9, W10, W11, W12, W13;
+
+    /* Top linear transformation, composed with the inverse affine map */
+    Y8 = X0 ^ X1;
+    Y3 = X0 ^ X3;
+    Y5 = X1 ^ X3;
+    Y6 = X0 ^ Y5;
+    Y19 = X4 ^ X7;
+    Y10 = Y8 ^ Y19;
+    Y1 = X3 ^ Y19;
+    Y9 = X3 ^ X4;
+    Y14 = X4 ^ Y6;
+    Y18 = X2 ^ Y9;
+    Y13 = X6 ^ Y1;
+    Y12 = Y14 ^ Y13;
+    Y4 = Y3 ^ Y12;
+    Y7 = X2 ^ Y4;
+    Y21 = X6 ^ Y7;
+    Y2 = Y5 ^ Y13;
+    Y16 = Y1 ^ Y7;
+    R0 = X0 ^ X5;
+    Y0 = X2 ^ R0;
+    Y15 = Y6 ^ Y0;
+    Y11 = Y4 ^ R0;
+    Y20 = Y9 ^ Y11;
+    Y17 = Y10 ^ Y11;
+
+    SBOX_MIDDLE;
+
+    /* Bottom linear transformation, composed with the inverse affine map */
+    W0 = Z6 ^ Z15;
+    W1 = Z12 ^ W0;
+    W2 = Z13 ^ W1;
+    W3 = Z8 ^ Z16;
+    W4 = Z0 ^ W2;
+    W5 = Z1 ^ Z4;
+    W6 = Z2 ^ Z10;
+    W7 = W5 ^ W6;
+    W8 = Z4 ^ Z7;
+    W9 = Z14 ^ W7;
+    W10 = Z5 ^ W3;
+    W11 = Z3 ^ W9;
+    W12 = Z11 ^ Z17;
+    W13 = Z3 ^ W2;
+    s->slice[7] = W10 ^ W13;
+    s->slice[6] = Z8 ^ Z9 ^ Z13 ^ Z17 ^ W0 ^ W11;
+    s->slice[5] = Z11 ^ W1 ^ W3 ^ W11;
+    s->slice[4] = Z2 ^ W3 ^ W4;
+    s->slice[3] = Z5 ^ W4 ^ W6 ^ W8 ^ W12;
+    s->slice[2] = W4 ^ W5 ^ W10;
+    s->slice[1] = Z16 ^ W8 ^ W13;
+    s->slice[0] = Z9 ^ Z15 ^ W12;
+}
+
+#define BIT_RANGE(from,to) ((((uint64_t)1 << (((to) - (from)) * SLICE_LANES)) - 1) << ((from) * SLICE_LANES))
+
+#define BIT_RANGE_LEFT(x,from,to,shift) (((x) & BIT_RANGE((from), (to))) << ((shift) * SLICE_LANES))
+#define BIT_RANGE_RIGHT(x,from,to,shift) (((x) & BIT_RANGE((from), (to))) >> ((shift) * SLICE_LANES))
+
+#ifndef SLICE_FIXSLICED
+static SLICE_TARGET void BS(ShiftRows)(STATE_T* s) {
+    int i;
+    for (i = 0; i < 8; i++) {
+        SLICE_T v = s->slice[i];
+        s->slice[i] =
+            (v & BIT_RANGE(0, 4)) |
+            BIT_RANGE_LEFT(v, 4, 5, 3) | BIT_RANGE_RIGHT(v, 5, 8, 1) |
+            BIT_RANGE_LEFT(v, 8, 10, 2) | BIT_RANGE_RIGHT(v, 10, 12, 2) |
+            BIT_RANGE_LEFT(v, 12, 15, 1) | BIT_RANGE_RIGHT(v, 15, 16, 3);
+    }
+}
+#endif
+
+static SLICE_TARGET void BS(InvShiftRows)(STATE_T* s) {
+    int i;
+    for (i = 0; i < 8; i++) {
+        SLICE_T v = s->slice[i];
+        s->slice[i] =
+            (v & BIT_RANGE(0, 4)) |
+            BIT_RANGE_LEFT(v, 4, 7, 1) | BIT_RANGE_RIGHT(v, 7, 8, 3) |
+            BIT_RANGE_LEFT(v, 8, 10, 2) | BIT_RANGE_RIGHT(v, 10, 12, 2) |
+            BIT_RANGE_LEFT(v, 12, 13, 3) | BIT_RANGE_RIGHT(v, 13, 16, 1);
+    }
+}
+
+#define ROT(x,b) (((x) >> ((b) * 4 * SLICE_LANES)) | ((x) << ((4-(b)) * 4 * SLICE_LANES)))
+
+/** MixColumns */
+static SLICE_TARGET void BS(MixColumns)(STATE_T* s) {
+    /* The MixColumns transform treats the bytes of the columns of the state as
+     * coefficients of a 3rd degree polynomial over GF(2^8) and multiplies them
+     * by the fixed polynomial a(x) = {03}x^3 + {01}x^2 + {01}x + {02}, modulo
+     * x^4 + {01}.
+     *
+     * In the inverse transform, we multiply by the inverse of a(x),
+     * a^-1(x) = {0b}x^3 + {0d}x^2 + {09}x + {0e}. This is equal to
+     * a(x) * ({04}x^2 + {05}), so InvMixColumns repeats the forward transform's
+     * code, followed by that (found in OpenSSL's bsaes-x86_64.pl, attributed
+     * to Jussi Kivilinna)
+     *
+     * In the bitsliced representation, a multiplication of every column by x
+     * mod x^4 + 1 is simply a right rotation.
+     */
+
+    /* A multiplication by a(x) can be rewritten as
+     * (x^3 + x^2 + x) + {02}*(x^3 + {01}).
+     *
+     * First compute s into the s? variables, (x^3 + {01}) * s into the s?_01
+     * variables and (x^3 + x^2 + x)*s into the s?_123 variables.
+     */
+    SLICE_T s0 = s->slice[0], s1 = s->slice[1], s2 = s->slice[2], s3 = s->slice[3];
+    SLICE_T s4 = s->slice[4], s5 = s->slice[5], s6 = s->slice[6], s7 = s->slice[7];
+    SLICE_T s0_01 = s0 ^ ROT(s0, 1), s0_123 = ROT(s0_01, 1) ^ ROT(s0, 3);
+    SLICE_T s1_01 = s1 ^ ROT(s1, 1), s1_123 = ROT(s1_01, 1) ^ ROT(s1, 3);
+    SLICE_T s2_01 = s2 ^ ROT(s2, 1), s2_123 = ROT(s2_01, 1) ^ ROT(s2, 3);
+    SLICE_T s3_01 = s3 ^ ROT(s3, 1), s3_123 = ROT(s3_01, 1) ^ ROT(s3, 3);
+    SLICE_T s4_01 = s4 ^ ROT(s4, 1), s4_123 = ROT(s4_01, 1) ^ ROT(s4, 3);
+    SLICE_T s5_01 = s5 ^ ROT(s5, 1), s5_123 = ROT(s5_01, 1) ^ ROT(s5, 3);
+    SLICE_T s6_01 = s6 ^ ROT(s6, 1), s6_123 = ROT(s6_01, 1) ^ ROT(s6, 3);
+    SLICE_T s7_01 = s7 ^ ROT(s7, 1), s7_123 = ROT(s7_01, 1) ^ ROT(s7, 3);
+    /* Now compute s = s?_123 + {02} * s?_01. */
+    s->slice[0] = s7_01 ^ s0_123;
+    s->slice[1] = s7_01 ^ s0_01 ^ s1_123;
+    s->slice[2] = s1_01 ^ s2_123;
+    s->slice[3] = s7_01 ^ s2_01 ^ s3_123;
+    s->slice[4] = s7_01 ^ s3_01 ^ s4_123;
+    s->slice[5] = s4_01 ^ s5_123;
+    s->slice[6] = s5_01 ^ s6_123;
+    s->slice[7] = s6_01 ^ s7_123;
+}
+
+/** The inverse of MixColumns */
+static SLICE_TARGET void BS(InvMixColumns)(STATE_T* s) {
+    /* The multiplication by a(x) of MixColumns, into the m? variables. It is
+     * repeated rather than called, as calling it from both directions makes
+     * GCC stop inlining it, and the encryption kernels get slower. */
+    SLICE_T s0 = s->slice[0], s1 = s->slice[1], s2 = s->slice[2], s3 = s->slice[3];
+    SLICE_T s4 = s->slice[4], s5 = s->slice[5], s6 = s->slice[6], s7 = s->slice[7];
+    SLICE_T s0_01 = s0 ^ ROT(s0, 1), s0_123 = ROT(s0_01, 1) ^ ROT(s0, 3);
+    SLICE_T s1_01 = s1 ^ ROT(s1, 1), s1_123 = ROT(s1_01, 1) ^ ROT(s1, 3);
+    SLICE_T s2_01 = s2 ^ ROT(s2, 1), s2_123 = ROT(s2_01, 1) ^ ROT(s2, 3);
+    SLICE_T s3_01 = s3 ^ ROT(s3, 1), s3_123 = ROT(s3_01, 1) ^ ROT(s3, 3);
+    SLICE_T s4_01 = s4 ^ ROT(s4, 1), s4_123 = ROT(s4_01, 1) ^ ROT(s4, 3);
+    SLICE_T s5_01 = s5 ^ ROT(s5, 1), s5_123 = ROT(s5_01, 1) ^ ROT(s5, 3);
+    SLICE_T s6_01 = s6 ^ ROT(s6, 1), s6_123 = ROT(s6_01, 1) ^ ROT(s6, 3);
+    SLICE_T s7_01 = s7 ^ ROT(s7, 1), s7_123 = ROT(s7_01, 1) ^ ROT(s7, 3);
+    SLICE_T m0 = s7_01 ^ s0_123, m1 = s7_01 ^ s0_01 ^ s1_123, m2 = s1_01 ^ s2_123, m3 = s7_01 ^ s2_01 ^ s3_123;
+    SLICE_T m4 = s7_01 ^ s3_01 ^ s4_123, m5 = s4_01 ^ s5_123, m6 = s5_01 ^ s6_123, m7 = s6_01 ^ s7_123;
+    /* In the reverse direction, we further need to multiply by
+     * {04}x^2 + {05}, which can be written as {04} * (x^2 + {01}) + {01}.
+     *
+     * First compute (x^2 + {01}) * m into the t?_02 variables: */
+    SLICE_T t0_02 = m0 ^ ROT(m0, 2), t1_02 = m1 ^ ROT(m1, 2), t2_02 = m2 ^ ROT(m2, 2), t3_02 = m3 ^ ROT(m3, 2);
+    SLICE_T t4_02 = m4 ^ ROT(m4, 2), t5_02 = m5 ^ ROT(m5, 2), t6_02 = m6 ^ ROT(m6, 2), t7_02 = m7 ^ ROT(m7, 2);
+    /* And then s = m + {04} * t?_02 */
+    s->slice[0] = m0 ^ t6_02;
+    s->slice[1] = m1 ^ t6_02 ^ t7_02;
+    s->slice[2] = m2 ^ t0_02 ^ t7_02;
+    s->slice[3] = m3 ^ t1_02 ^ t6_02;
+    s->slice[4] = m4 ^ t2_02 ^ t6_02 ^ t7_02;
+    s->slice[5] = m5 ^ t3_02 ^ t7_02;
+    s->slice[6] = m6 ^ t4_02;
+    s->slice[7] = m7 ^ t5_02;
+}
+
+static SLICE_TARGET void BS(AddRoundKey)(STATE_T* s, const STATE_T* round) {
+    int b;
+    for (b = 0; b < 8; b++) {
+        s->slice[b] ^= round->slice[b];
+    }
+}
+
+#ifdef SLICE_FIXSLICED
+/* Semi-fixslicing, from:
+ *   Alexandre Adomnicai and Thomas Peyrin, Fixslicing AES-like Ciphers
+ *   https://eprint.iacr.org/2020/1123.pdf
+ *
+ * ShiftRows only moves bytes within rows, so it commutes with SubBytes and
+ * (after permuting the round key the same way) AddRoundKey. The only step
+ * that cares where bytes are is MixColumns. So in odd rounds we skip
+ * ShiftRows, and keep s in an ordering where the real state is ShiftRows(s):
+ * MixColumns then becomes a variant that rotates every row by one extra
+ * column, and the round key is stored with InvShiftRows applied. In even
+ * rounds two ShiftRows are due, and ShiftRows^2, which swaps the two halves of
+ * rows 1 and 3, is a lot cheaper than a single ShiftRows. As AES has an even
+ * number of rounds, the last round ends in the normal ordering again.
+ * Encryption also takes an odd number of rounds, which CTR uses to start
+ * after the first one: its last round then starts in the normal ordering,
+ * and does its ShiftRows as InvShiftRows and ShiftRows^2, with a last round
+ * key that is stored normally.
+ */
+
+/* The mask of columns [0, n) of every row. */
+#define ROW_MASK(n) (BIT_RANGE(0, (n)) * (1 | ((uint64_t)1 << (4 * SLICE_LANES)) | ((uint64_t)1 << (8 * SLICE_LANES)) | ((uint64_t)1 << (12 * SLICE_LANES))))
+/* Rotate every row of x to the left by m columns: column c gets what was in column c + m. */
+#define COL_ROT(x,m) ((((x) >> ((m) * SLICE_LANES)) & ROW_MASK(4 - (m))) | (((x) << ((4 - (m)) * SLICE_LANES)) & ~ROW_MASK(4 - (m))))
+
+/** ShiftRows applied twice, which is its own inverse */
+static SLICE_TARGET void BS(ShiftRows2)(STATE_T* s) {
+    int i;
+    for (i = 0; i < 8; i++) {
+        SLICE_T v = s->slice[i];
+        s->slice[i] =
+            (v & BIT_RANGE(0, 4)) |
+            BIT_RANGE_LEFT(v, 4, 6, 2) | BIT_RANGE_RIGHT(v, 6, 8, 2) |
+            (v & BIT_RANGE(8, 12)) |
+            BIT_RANGE_LEFT(v, 12, 14, 2) | BIT_RANGE_RIGHT(v, 14, 16, 2);
+    }
+}
+
+/** MixColumns on the real state ShiftRows(s), in place on s */
+static SLICE_TARGET void BS(MixColumnsFixsliced)(STATE_T* s) {
+    /* See MixColumns for the derivation. Rotating the real state's columns by
+     * b rows, ROT(x, b), becomes ROT(COL_ROT(x, b), b) here, so compute s?
+     * rotated by 1, 2 and 3 columns into the s?_c1, s?_c2 and s?_c3 variables
+     * first. */
+    SLICE_T s0 = s->slice[0], s1 = s->slice[1], s2 = s->slice[2], s3 = s->slice[3];
+    SLICE_T s4 = s->slice[4], s5 = s->slice[5], s6 = s->slice[6], s7 = s->slice[7];
+    SLICE_T s0_c1 = COL_ROT(s0, 1), s0_c2 = COL_ROT(s0, 2), s0_c3 = COL_ROT(s0, 3);
+    SLICE_T s1_c1 = COL_ROT(s1, 1), s1_c2 = COL_ROT(s1, 2), s1_c3 = COL_ROT(s1, 3);
+    SLICE_T s2_c1 = COL_ROT(s2, 1), s2_c2 = COL_ROT(s2, 2), s2_c3 = COL_ROT(s2, 3);
+    SLICE_T s3_c1 = COL_ROT(s3, 1), s3_c2 = COL_ROT(s3, 2), s3_c3 = COL_ROT(s3, 3);
+    SLICE_T s4_c1 = COL_ROT(s4, 1), s4_c2 = COL_ROT(s4, 2), s4_c3 = COL_ROT(s4, 3);
+    SLICE_T s5_c1 = COL_ROT(s5, 1), s5_c2 = COL_ROT(s5, 2), s5_c3 = COL_ROT(s5, 3);
+    SLICE_T s6_c1 = COL_ROT(s6, 1), s6_c2 = COL_ROT(s6, 2), s6_c3 = COL_ROT(s6, 3);
+    SLICE_T s7_c1 = COL_ROT(s7, 1), s7_c2 = COL_ROT(s7, 2), s7_c3 = COL_ROT(s7, 3);
+    SLICE_T s0_01 = s0 ^ ROT(s0_c1, 1), s0_123 = ROT(s0_c1 ^ ROT(s0_c2, 1), 1) ^ ROT(s0_c3, 3);
+    SLICE_T s1_01 = s1 ^ ROT(s1_c1, 1), s1_123 = ROT(s1_c1 ^ ROT(s1_c2, 1), 1) ^ ROT(s1_c3, 3);
+    SLICE_T s2_01 = s2 ^ ROT(s2_c1, 1), s2_123 = ROT(s2_c1 ^ ROT(s2_c2, 1), 1) ^ ROT(s2_c3, 3);
+    SLICE_T s3_01 = s3 ^ ROT(s3_c1, 1), s3_123 = ROT(s3_c1 ^ ROT(s3_c2, 1), 1) ^ ROT(s3_c3, 3);
+    SLICE_T s4_01 = s4 ^ ROT(s4_c1, 1), s4_123 = ROT(s4_c1 ^ ROT(s4_c2, 1), 1) ^ ROT(s4_c3, 3);
+    SLICE_T s5_01 = s5 ^ ROT(s5_c1, 1), s5_123 = ROT(s5_c1 ^ ROT(s5_c2, 1), 1) ^ ROT(s5_c3, 3);
+    SLICE_T s6_01 = s6 ^ ROT(s6_c1, 1), s6_123 = ROT(s6_c1 ^ ROT(s6_c2, 1), 1) ^ ROT(s6_c3, 3);
+    SLICE_T s7_01 = s7 ^ ROT(s7_c1, 1), s7_123 = ROT(s7_c1 ^ ROT(s7_c2, 1), 1) ^ ROT(s7_c3, 3);
+    s->slice[0] = s7_01 ^ s0_123;
+    s->slice[1] = s7_01 ^ s0_01 ^ s1_123;
+    s->slice[2] = s1_01 ^ s2_123;
+    s->slice[3] = s7_01 ^ s2_01 ^ s3_123;
+    s->slice[4] = s7_01 ^ s3_01 ^ s4_123;
+    s->slice[5] = s4_01 ^ s5_123;
+    s->slice[6] = s5_01 ^ s6_123;
+    s->slice[7] = s6_01 ^ s7_123;
+}
+
+/** InvMixColumns on the real state ShiftRows(s), in place on s */
+static SLICE_TARGET void BS(InvMixColumnsFixsliced)(STATE_T* s) {
+    /* See InvMixColumns and MixColumnsFixsliced. */
+    SLICE_T s0 = s->slice[0], s1 = s->slice[1], s2 = s->slice[2], s3 = s->slice[3];
+    SLICE_T s4 = s->slice[4], s5 = s->slice[5], s6 = s->slice[6], s7 = s->slice[7];
+    SLICE_T s0_c1 = COL_ROT(s0, 1), s0_c2 = COL_ROT(s0, 2), s0_c3 = COL_ROT(s0, 3);
+    SLICE_T s1_c1 = COL_ROT(s1, 1), s1_c2 = COL_ROT(s1, 2), s1_c3 = COL_ROT(s1, 3);
+    SLICE_T s2_c1 = COL_ROT(s2, 1), s2_c2 = COL_ROT(s2, 2), s2_c3 = COL_ROT(s2, 3);
+    SLICE_T s3_c1 = COL_ROT(s3, 1), s3_c2 = COL_ROT(s3, 2), s3_c3 = COL_ROT(s3, 3);
+    SLICE_T s4_c1 = COL_ROT(s4, 1), s4_c2 = COL_ROT(s4, 2), s4_c3 = COL_ROT(s4, 3);
+    SLICE_T s5_c1 = COL_ROT(s5, 1), s5_c2 = COL_ROT(s5, 2), s5_c3 = COL_ROT(s5, 3);
+    SLICE_T s6_c1 = COL_ROT(s6, 1), s6_c2 = COL_ROT(s6, 2), s6_c3 = COL_ROT(s6, 3);
+    SLICE_T s7_c1 = COL_ROT(s7, 1), s7_c2 = COL_ROT(s7, 2), s7_c3 = COL_ROT(s7, 3);
+    SLICE_T s0_01 = s0 ^ ROT(s0_c1, 1), s0_123 = ROT(s0_c1 ^ ROT(s0_c2, 1), 1) ^ ROT(s0_c3, 3);
+    SLICE_T s1_01 = s1 ^ ROT(s1_c1, 1), s1_123 = ROT(s1_c1 ^ ROT(s1_c2, 1), 1) ^ ROT(s1_c3, 3);
+    SLICE_T s2_01 = s2 ^ ROT(s2_c1, 1), s2_123 = ROT(s2_c1 ^ ROT(s2_c2, 1), 1) ^ ROT(s2_c3, 3);
+    SLICE_T s3_01 = s3 ^ ROT(s3_c1, 1), s3_123 = ROT(s3_c1 ^ ROT(s3_c2, 1), 1) ^ ROT(s3_c3, 3);
+    SLICE_T s4_01 = s4 ^ ROT(s4_c1, 1), s4_123 = ROT(s4_c1 ^ ROT(s4_c2, 1), 1) ^ ROT(s4_c3, 3);
+    SLICE_T s5_01 = s5 ^ ROT(s5_c1, 1), s5_123 = ROT(s5_c1 ^ ROT(s5_c2, 1), 1) ^ ROT(s5_c3, 3);
+    SLICE_T s6_01 = s6 ^ ROT(s6_c1, 1), s6_123 = ROT(s6_c1 ^ ROT(s6_c2, 1), 1) ^ ROT(s6_c3, 3);
+    SLICE_T s7_01 = s7 ^ ROT(s7_c1, 1), s7_123 = ROT(s7_c1 ^ ROT(s7_c2, 1), 1) ^ ROT(s7_c3, 3);
+    SLICE_T m0 = s7_01 ^ s0_123, m1 = s7_01 ^ s0_01 ^ s1_123, m2 = s1_01 ^ s2_123, m3 = s7_01 ^ s2_01 ^ s3_123;
+    SLICE_T m4 = s7_01 ^ s3_01 ^ s4_123, m5 = s4_01 ^ s5_123, m6 = s5_01 ^ s6_123, m7 = s6_01 ^ s7_123;
+    SLICE_T t0_02 = m0 ^ ROT(COL_ROT(m0, 2), 2), t1_02 = m1 ^ ROT(COL_ROT(m1, 2), 2);
+    SLICE_T t2_02 = m2 ^ ROT(COL_ROT(m2, 2), 2), t3_02 = m3 ^ ROT(COL_ROT(m3, 2), 2);
+    SLICE_T t4_02 = m4 ^ ROT(COL_ROT(m4, 2), 2), t5_02 = m5 ^ ROT(COL_ROT(m5, 2), 2);
+    SLICE_T t6_02 = m6 ^ ROT(COL_ROT(m6, 2), 2), t7_02 = m7 ^ ROT(COL_ROT(m7, 2), 2);
+    s->slice[0] = m0 ^ t6_02;
+    s->slice[1] = m1 ^ t6_02 ^ t7_02;
+    s->slice[2] = m2 ^ t0_02 ^ t7_02;
+    s->slice[3] = m3 ^ t1_02 ^ t6_02;
+    s->slice[4] = m4 ^ t2_02 ^ t6_02 ^ t7_02;
+    s->slice[5] = m5 ^ t3_02 ^ t7_02;
+    s->slice[6] = m6 ^ t4_02;
+    s->slice[7] = m7 ^ t5_02;
+}
+
+/** Encrypt the BLOCKS blocks in s, using semi-fixsliced round keys in the layout of STATE_T */
+static SLICE_TARGET void BS(EncryptState)(const STATE_T* rounds, int nrounds, STATE_T* s) {
+    int round;
+
+    BS(AddRoundKey)(s, rounds++);
+
+    for (round = 1; round < nrounds; round++) {
+        BS(SubBytes_fwd)(s);
+        if (round & 1) {
+            BS(MixColumnsFixsliced)(s);
+        } else {
+            BS(ShiftRows2)(s);
+            BS(MixColumns)(s);
+        }
+        BS(AddRoundKey)(s, rounds++);
+    }
+
+    BS(SubBytes_fwd)(s);
+    if (nrounds & 1) {
+        BS(InvShiftRows)(s);
+    }
+    BS(ShiftRows2)(s);
+    BS(AddRoundKey)(s, rounds);
+}
+
+/** Decrypt BLOCKS blocks, using semi-fixsliced round keys in the layout of STATE_T */
+static SLICE_TARGET void BS(AES_decrypt)(const STATE_T* rounds, int nrounds, unsigned char* plain, const unsigned char* cipher) {
+    /* Round keys are used in reverse order */
+    int round;
+    STATE_T s;
+    rounds += nrounds;
+
+    BS(LoadBytes)(&s, cipher);
+    BS(AddRoundKey)(&s, rounds--);
+    BS(ShiftRows2)(&s);
+
+    for (round = nrounds - 1; round > 0; round--) {
+        BS(SubBytes_inv)(&s);
+        BS(AddRoundKey)(&s, rounds--);
+        if (round & 1) {
+            BS(InvMixColumnsFixsliced)(&s);
+        } else {
+            BS(InvMixColumns)(&s);
+            BS(ShiftRows2)(&s);
+        }
+    }
+
+    BS(SubBytes_inv)(&s);
+    BS(AddRoundKey)(&s, rounds);
+
+    BS(SaveBytes)(plain, &s);
+}
+
+#undef COL_ROT
+#undef ROW_MASK
+#else
+/** Encrypt the BLOCKS blocks in s, using round keys in the layout of STATE_T */
+static SLICE_TARGET void BS(EncryptState)(const STATE_T* rounds, int nrounds, STATE_T* s) {
+    int round;
+
+    BS(AddRoundKey)(s, rounds++);
+
+    for (round = 1; round < nrounds; round++) {
+        BS(SubBytes_fwd)(s);
+        BS(ShiftRows)(s);
+        BS(MixColumns)(s);
+        BS(AddRoundKey)(s, rounds++);
+    }
+
+    BS(SubBytes_fwd)(s);
+    BS(ShiftRows)(s);
+    BS(AddRoundKey)(s, rounds);
+}
+
+/** Decrypt BLOCKS blocks, using round keys in the layout of STATE_T */
+static SLICE_TARGET void BS(AES_decrypt)(const STATE_T* rounds, int nrounds, unsigned char* plain, const unsigned char* cipher) {
+    /* Most AES decryption implementations use the alternate scheme
+     * (the Equivalent Inverse Cipher), which allows for more code reuse between
+     * the encryption and decryption code, but requires separate setup for both.
+     */
+    STATE_T s;
+    int round;
+
+    rounds += nrounds;
+
+    BS(LoadBytes)(&s, cipher);
+    BS(AddRoundKey)(&s, rounds--);
+
+    for (round = 1; round < nrounds; round++) {
+        BS(InvShiftRows)(&s);
+        BS(SubBytes_inv)(&s);
+        BS(AddRoundKey)(&s, rounds--);
+        BS(InvMixColumns)(&s);
+    }
+
+    BS(InvShiftRows)(&s);
+    BS(SubBytes_inv)(&s);
+    BS(AddRoundKey)(&s, rounds);
+
+    BS(SaveBytes)(plain, &s);
+}
+
+#endif
+
+/** Encrypt BLOCKS blocks, using round keys in the layout of STATE_T */
+static SLICE_TARGET void BS(AES_encrypt)(const STATE_T* rounds, int nrounds, unsigned char* cipher, const unsigned char* plain) {
+    STATE_T s;
+    BS(LoadBytes)(&s, plain);
+    BS(EncryptState)(rounds, nrounds, &s);
+    BS(SaveBytes)(cipher, &s);
+}
+
+#if BLOCKS > 1
+/** Load the nrounds + 1 round keys in rounds into every block of the STATE_T array wide_rounds, as AES_encrypt and AES_decrypt use them */
+static SLICE_TARGET void BS(LoadGroupKeys)(void* wide_rounds, const AES_state* rounds, int nrounds) {
+    STATE_T* wide = wide_rounds;
+    int i;
+    for (i = 0; i <= nrounds; i++) {
+        BS(LoadKey)(&wide[i], &rounds[i]);
+#ifdef SLICE_FIXSLICED
+        if ((i & 1) && i < nrounds) {
+            BS(InvShiftRows)(&wide[i]);
+        }
+#endif
+    }
+}
+
+/** Return the round keys of keys as LoadGroupKeys loads them: prepared in keys->wide_rounds, or else loaded into buf */
+static SLICE_TARGET const STATE_T* BS(GroupKeys)(const AES_keys* keys, STATE_T* buf) {
+    if (keys->wide_rounds && keys->wide_load == BS(LoadGroupKeys)) {
+        return keys->wide_rounds;
+    }
+    BS(LoadGroupKeys)(buf, keys->rounds, keys->nrounds);
+    return buf;
+}
+
+/** Encrypt as many groups of BLOCKS consecutive blocks as possible, returning the number of blocks processed */
+static SLICE_TARGET size_t BS(AES_encrypt_groups)(const AES_keys* keys, size_t blocks, unsigned char* cipher, const unsigned char* plain) {
+    STATE_T buf[15];
+    const STATE_T* wide_rounds;
+    size_t done;
+    if (blocks < BLOCKS) return 0;
+    wide_rounds = BS(GroupKeys)(keys, buf);
+    for (done = 0; done + BLOCKS <= blocks; done += BLOCKS) {
+        BS(AES_encrypt)(wide_rounds, keys->nrounds, cipher + done * 16, plain + done * 16);
+    }
+    return done;
+}
+
+/** Decrypt as many groups of BLOCKS consecutive blocks as possible, returning the number of blocks processed */
+static SLICE_TARGET size_t BS(AES_decrypt_groups)(const AES_keys* keys, size_t blocks, unsigned char* plain, const unsigned char* cipher) {
+    STATE_T buf[15];
+    const STATE_T* wide_rounds;
+    size_t done;
+    if (blocks < BLOCKS) return 0;
+    wide_rounds = BS(GroupKeys)(keys, buf);
+    for (done = 0; done + BLOCKS <= blocks; done += BLOCKS) {
+        BS(AES_decrypt)(wide_rounds, keys->nrounds, plain + done * 16, cipher + done * 16);
+    }
+    return done;
+}
+
+/** CTR encrypt runs times 256 counter blocks from after their first round, as
+ *  AESCTR_crypt_runs in ctaes.c computes it: block b of run r starts as the
+ *  16 bytes bases + 16 * r with the 4 bytes cols + 4 * b added to its first
+ *  column, and its keystream is XORed from in into out. These states are put
+ *  together in sliced form, so that only the output is transposed per group.
+ */
+static SLICE_TARGET void BS(AES_encrypt_runs)(const AES_keys* keys, const unsigned char* cols, const unsigned char* bases, size_t runs, unsigned char* out, const unsigned char* in) {
+    STATE_T key_buf[15], sliced_cols[256 / BLOCKS], base;
+    const STATE_T* wide_rounds = BS(GroupKeys)(keys, key_buf);
+    unsigned char buf[BLOCKS * 16];
+    size_t r, g;
+    int b, i;
+
+    memset(buf, 0, sizeof(buf));
+    for (g = 0; g < 256 / BLOCKS; g++) {
+        for (b = 0; b < BLOCKS; b++) {
+            memcpy(buf + 16 * b, cols + 4 * (g * BLOCKS + b), 4);
+        }
+        BS(LoadBytes)(&sliced_cols[g], buf);
+    }
+    for (r = 0; r < runs; r++) {
+        for (b = 0; b < BLOCKS; b++) {
+            memcpy(buf + 16 * b, bases + 16 * r, 16);
+        }
+        BS(LoadBytes)(&base, buf);
+        for (g = 0; g < 256 / BLOCKS; g++) {
+            STATE_T s = base;
+            BS(AddRoundKey)(&s, &sliced_cols[g]);
+            BS(EncryptState)(wide_rounds, keys->nrounds, &s);
+            BS(SaveBytes)(buf, &s);
+            for (i = 0; i < BLOCKS * 16; i++) {
+                out[i] = in[i] ^ buf[i];
+            }
+            out += BLOCKS * 16;
+            in += BLOCKS * 16;
+        }
+    }
+}
+
+/** Load the round keys of keys[b] into block b of wide_rounds, for every b < BLOCKS */
+static SLICE_TARGET void BS(LoadLaneKeys)(STATE_T* wide_rounds, const AES_keys* keys) {
+    SLICE_ELEM_T elems[8][SLICE_ELEMS];
+    int i, b, e, l;
+    for (i = 0; i <= keys->nrounds; i++) {
+        for (b = 0; b < 8; b++) {
+            for (e = 0; e < SLICE_ELEMS; e++) {
+                uint64_t x = 0;
+                for (l = 0; l < SLICE_LANES; l++) {
+                    x |= BS(SpreadSlice)(keys[e * SLICE_LANES + l].rounds[i].slice[b]) << l;
+                }
+                elems[b][e] = x;
+            }
+        }
+        memcpy(wide_rounds[i].slice, elems, sizeof(elems));
+#ifdef SLICE_FIXSLICED
+        if ((i & 1) && i < keys->nrounds) {
+            BS(InvShiftRows)(&wide_rounds[i]);
+        }
+#endif
+    }
+}
+
+/** Encrypt as many groups of BLOCKS blocks as possible, block b from plain[b] to cipher[b] with keys[b], returning the number of blocks processed */
+static SLICE_TARGET size_t BS(AES_encrypt_lanes)(const AES_keys* keys, size_t blocks, unsigned char* const* cipher, const unsigned char* const* plain) {
+    STATE_T wide_rounds[15];
+    unsigned char buf[BLOCKS * 16];
+    size_t done;
+    int b;
+    for (done = 0; done + BLOCKS <= blocks; done += BLOCKS) {
+        BS(LoadLaneKeys)(wide_rounds, keys + done);
+        for (b = 0; b < BLOCKS; b++) {
+            memcpy(buf + 16 * b, plain[done + b], 16);
+        }
+        BS(AES_encrypt)(wide_rounds, keys->nrounds, buf, buf);
+        for (b = 0; b < BLOCKS; b++) {
+            memcpy(cipher[done + b], buf + 16 * b, 16);
+        }
+    }
+    return done;
+}
+
+/** Decrypt as many groups of BLOCKS blocks as possible, block b from cipher[b] to plain[b] with keys[b], returning the number of blocks processed */
+static SLICE_TARGET size_t BS(AES_decrypt_lanes)(const AES_keys* keys, size_t blocks, unsigned char* const* plain, const unsigned char* const* cipher) {
+    STATE_T wide_rounds[15];
+    unsigned char buf[BLOCKS * 16];
+    size_t done;
+    int b;
+    for (done = 0; done + BLOCKS <= blocks; done += BLOCKS) {
+        BS(LoadLaneKeys)(wide_rounds, keys + done);
+        for (b = 0; b < BLOCKS; b++) {
+            memcpy(buf + 16 * b, cipher[done + b], 16);
+        }
+        BS(AES_decrypt)(wide_rounds, keys->nrounds, buf, buf);
+        for (b = 0; b < BLOCKS; b++) {
+            memcpy(plain[done + b], buf + 16 * b, 16);
+        }
+    }
+    return done;
+}
+#endif
+
+#undef ROT
+#undef SBOX_MIDDLE
+#undef WORD_UNIT
+#undef DELTASWAP
+#undef SWAPMOVE
+#undef REPEAT8
+#undef BIT_RANGE_RIGHT
+#undef BIT_RANGE_LEFT
+#undef BIT_RANGE
+#undef BLOCKS
+
+#undef SLICE_FIXSLICED
+#undef SLICE_TARGET
+#undef BS
+#undef STATE_T
+#undef SLICE_LANES
+#undef SLICE_ELEM
+#undef SLICE_ELEMS
+#undef SLICE_ELEM_T
+#undef SLICE_T
@@ -4,12 +4,38 @@
  * file COPYING or https://opensource.org/licenses/mit-license.php.   *
  **********************************************************************/
 
+#if defined(__unix__) || defined(__APPLE__)
+/* For mkstemp. */
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include "ctaes.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+/* The largest number of blocks passed to a single call in the multi-block tests. */
+#define MULTI_BLOCKS 40
+
+/* The number of contexts in the AES*_init_many and AES*_encrypt_many tests. */
+#define MULTI_KEYS 37
+
+/* The number of blocks in the long CBC decryption test, more than one chunk. */
+#define CBC_BLOCKS 150
+
+/* The number of streams in the AES*_CBC_encrypt_streams test, more than are
+ * encrypted at once. */
+#define CBC_STREAMS 70
+
+/* The number of blocks in the long CTR test, enough for a few chunks and two
+ * whole runs of 256 counter blocks after the first, partial one. */
+#define CTR_BLOCKS 800
+
 typedef struct {
     int keysize;
     const char* key;
@@ -66,6 +92,25 @@ static const ctaes_cbc_test ctaes_cbc_tests[] = {
     }
 };
 
+/* AES-CTR test vectors from NIST sp800-38a, with the initial counter block as iv. */
+static const ctaes_cbc_test ctaes_ctr_tests[] = {
+    {
+        128, "2b7e151628aed2a6abf7158809cf4f3c", "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff", 4,
+        "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e5130c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710",
+        "874d6191b620e3261bef6864990db6ce9806f66b7970fdff8617187bb9fffdff5ae4df3edbd5d35e5b4f09020db03eab1e031dda2fbe03d1792170a0f3009cee"
+    },
+    {
+        192, "8e73b0f7da0e6452c810f32b809079e562f8ead2522c6b7b", "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff", 4,
+        "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e5130c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710",
+        "1abc932417521ca24f2b0459fe7e6e0b090339ec0aa6faefd5ccc2c6f4ce8e941e36b26bd1ebc670d1bd1d665620abf74f78a7f6d29809585a97daec58c6b050"
+    },
+    {
+        256, "603deb1015ca71be2b73aef0857d77811f352c073b6108d72d9810a30914dff4", "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff", 4,
+        "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e5130c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710",
+        "601ec313775789a5b7a7f504bbf3d228f443e3ca4d62b59aca84e990cacaf5c52b0930daa23de94ce87017ba2d84988ddfc9c58db67aada613c2dd08457941a6"
+    }
+};
+
 static void from_hex(unsigned char* data, int len, const char* hex) {
     int p;
     for (p = 0; p < len; p++) {
@@ -85,11 +130,14 @@ static void from_hex(unsigned char* data, int len, const char* hex) {
     assert(*hex == 0);
 }
 
-int main(void) {
+/* Run all tests with AES_set_portable(portable), returning the number of failures. */
+static int run_tests(int portable) {
     int i;
+    size_t v;
     int fail = 0;
+    AES_set_portable(portable);
     for (i = 0; i < sizeof(ctaes_tests) / sizeof(ctaes_tests[0]); i++) {
-        unsigned char key[32], plain[16], cipher[16], ciphered[16], deciphered[16];
+        unsigned char key[32], plain[16], cipher[16], ciphered[16], deciphered[16], deciphered_eq[16], ciphered_otf[16], deciphered_otf[16];
         const ctaes_test* test = &ctaes_tests[i];
         assert(test->keysize == 128 || test->keysize == 192 || test->keysize == 256);
         from_hex(plain, 16, test->plain);
@@ -97,26 +145,47 @@ int main(void) {
         switch (test->keysize) {
             case 128: {
                 AES128_ctx ctx;
+                AES128_dec_ctx dec_ctx;
+                AES128_otf_ctx otf_ctx;
                 from_hex(key, 16, test->key);
                 AES128_init(&ctx, key);
                 AES128_encrypt(&ctx, 1, ciphered, plain);
                 AES128_decrypt(&ctx, 1, deciphered, cipher);
+                AES128_dec_init(&dec_ctx, key);
+                AES128_dec_decrypt(&dec_ctx, 1, deciphered_eq, cipher);
+                AES128_otf_init(&otf_ctx, key);
+                AES128_otf_encrypt(&otf_ctx, 1, ciphered_otf, plain);
+                AES128_otf_decrypt(&otf_ctx, 1, deciphered_otf, cipher);
                 break;
             }
             case 192: {
                 AES192_ctx ctx;
+                AES192_dec_ctx dec_ctx;
+                AES192_otf_ctx otf_ctx;
                 from_hex(key, 24, test->key);
                 AES192_init(&ctx, key);
                 AES192_encrypt(&ctx, 1, ciphered, plain);
                 AES192_decrypt(&ctx, 1, deciphered, cipher);
+                AES192_dec_init(&dec_ctx, key);
+                AES192_dec_decrypt(&dec_ctx, 1, deciphered_eq, cipher);
+                AES192_otf_init(&otf_ctx, key);
+                AES192_otf_encrypt(&otf_ctx, 1, ciphered_otf, plain);
+                AES192_otf_decrypt(&otf_ctx, 1, deciphered_otf, cipher);
                 break;
             }
             case 256: {
                 AES256_ctx ctx;
+                AES256_dec_ctx dec_ctx;
+                AES256_otf_ctx otf_ctx;
                 from_hex(key, 32, test->key);
                 AES256_init(&ctx, key);
                 AES256_encrypt(&ctx, 1, ciphered, plain);
                 AES256_decrypt(&ctx, 1, deciphered, cipher);
+                AES256_dec_init(&dec_ctx, key);
+                AES256_dec_decrypt(&dec_ctx, 1, deciphered_eq, cipher);
+                AES256_otf_init(&otf_ctx, key);
+                AES256_otf_encrypt(&otf_ctx, 1, ciphered_otf, plain);
+                AES256_otf_decrypt(&otf_ctx, 1, deciphered_otf, cipher);
                 break;
             }
         }
@@ -128,41 +197,87 @@ int main(void) {
             fprintf(stderr, "D(key=\"%s\", cipher=\"%s\") != \"%s\"\n", test->key, test->cipher, test->plain);
             fail++;
         }
+        if (memcmp(plain, deciphered_eq, 16)) {
+            fprintf(stderr, "D_eq(key=\"%s\", cipher=\"%s\") != \"%s\"\n", test->key, test->cipher, test->plain);
+            fail++;
+        }
+        if (memcmp(cipher, ciphered_otf, 16)) {
+            fprintf(stderr, "E_otf(key=\"%s\", plain=\"%s\") != \"%s\"\n", test->key, test->plain, test->cipher);
+            fail++;
+        }
+        if (memcmp(plain, deciphered_otf, 16)) {
+            fprintf(stderr, "D_otf(key=\"%s\", cipher=\"%s\") != \"%s\"\n", test->key, test->cipher, test->plain);
+            fail++;
+        }
     }
     for (i = 0; i < sizeof(ctaes_cbc_tests) / sizeof(ctaes_cbc_tests[0]); i++) {
         const ctaes_cbc_test* test = &ctaes_cbc_tests[i];
-        unsigned char key[32], iv[16], plain[4 * 16], cipher[4 * 16], ciphered[4 * 16], deciphered[4 * 16];
+        unsigned char key[32], iv[16], plain[4 * 16], cipher[4 * 16], ciphered[4 * 16], deciphered[4 * 16], deciphered_eq[4 * 16];
+        unsigned char iv_enc[16], iv_dec[16], iv_dec_eq[16], ciphered_iv[4 * 16], deciphered_iv[4 * 16], deciphered_eq_iv[4 * 16];
         assert(test->keysize == 128 || test->keysize == 192 || test->keysize == 256);
         assert(test->nblocks == 4);
         from_hex(iv, 16, test->iv);
         from_hex(plain, test->nblocks * 16, test->plain);
         from_hex(cipher, test->nblocks * 16, test->cipher);
+        memcpy(iv_enc, iv, 16);
+        memcpy(iv_dec, iv, 16);
+        memcpy(iv_dec_eq, iv, 16);
         switch (test->keysize) {
             case 128: {
                 AES128_CBC_ctx ctx;
+                AES128_CBC_dec_ctx dec_ctx;
                 from_hex(key, 16, test->key);
                 AES128_CBC_init(&ctx, key, iv);
                 AES128_CBC_encrypt(&ctx, test->nblocks, ciphered, plain);
                 AES128_CBC_init(&ctx, key, iv);
                 AES128_CBC_decrypt(&ctx, test->nblocks, deciphered, cipher);
+                AES128_CBC_dec_init(&dec_ctx, key, iv);
+                AES128_CBC_dec_decrypt(&dec_ctx, test->nblocks, deciphered_eq, cipher);
+                /* In two calls, to test that the iv is updated. */
+                AES128_CBC_encrypt_iv(&ctx.ctx, iv_enc, 1, ciphered_iv, plain);
+                AES128_CBC_encrypt_iv(&ctx.ctx, iv_enc, test->nblocks - 1, ciphered_iv + 16, plain + 16);
+                AES128_CBC_decrypt_iv(&ctx.ctx, iv_dec, 1, deciphered_iv, cipher);
+                AES128_CBC_decrypt_iv(&ctx.ctx, iv_dec, test->nblocks - 1, deciphered_iv + 16, cipher + 16);
+                AES128_CBC_dec_decrypt_iv(&dec_ctx.ctx, iv_dec_eq, 1, deciphered_eq_iv, cipher);
+                AES128_CBC_dec_decrypt_iv(&dec_ctx.ctx, iv_dec_eq, test->nblocks - 1, deciphered_eq_iv + 16, cipher + 16);
                 break;
             }
             case 192: {
                 AES192_CBC_ctx ctx;
+                AES192_CBC_dec_ctx dec_ctx;
                 from_hex(key, 24, test->key);
                 AES192_CBC_init(&ctx, key, iv);
                 AES192_CBC_encrypt(&ctx, test->nblocks, ciphered, plain);
                 AES192_CBC_init(&ctx, key, iv);
                 AES192_CBC_decrypt(&ctx, test->nblocks, deciphered, cipher);
+                AES192_CBC_dec_init(&dec_ctx, key, iv);
+                AES192_CBC_dec_decrypt(&dec_ctx, test->nblocks, deciphered_eq, cipher);
+                /* In two calls, to test that the iv is updated. */
+                AES192_CBC_encrypt_iv(&ctx.ctx, iv_enc, 1, ciphered_iv, plain);
+                AES192_CBC_encrypt_iv(&ctx.ctx, iv_enc, test->nblocks - 1, ciphered_iv + 16, plain + 16);
+                AES192_CBC_decrypt_iv(&ctx.ctx, iv_dec, 1, deciphered_iv, cipher);
+                AES192_CBC_decrypt_iv(&ctx.ctx, iv_dec, test->nblocks - 1, deciphered_iv + 16, cipher + 16);
+                AES192_CBC_dec_decrypt_iv(&dec_ctx.ctx, iv_dec_eq, 1, deciphered_eq_iv, cipher);
+                AES192_CBC_dec_decrypt_iv(&dec_ctx.ctx, iv_dec_eq, test->nblocks - 1, deciphered_eq_iv + 16, cipher + 16);
                 break;
             }
             case 256: {
                 AES256_CBC_ctx ctx;
+                AES256_CBC_dec_ctx dec_ctx;
                 from_hex(key, 32, test->key);
                 AES256_CBC_init(&ctx, key, iv);
                 AES256_CBC_encrypt(&ctx, test->nblocks, ciphered, plain);
                 AES256_CBC_init(&ctx, key, iv);
                 AES256_CBC_decrypt(&ctx, test->nblocks, deciphered, cipher);
+                AES256_CBC_dec_init(&dec_ctx, key, iv);
+                AES256_CBC_dec_decrypt(&dec_ctx, test->nblocks, deciphered_eq, cipher);
+                /* In two calls, to test that the iv is updated. */
+                AES256_CBC_encrypt_iv(&ctx.ctx, iv_enc, 1, ciphered_iv, plain);
+                AES256_CBC_encrypt_iv(&ctx.ctx, iv_enc, test->nblocks - 1, ciphered_iv + 16, plain + 16);
+                AES256_CBC_decrypt_iv(&ctx.ctx, iv_dec, 1, deciphered_iv, cipher);
+                AES256_CBC_decrypt_iv(&ctx.ctx, iv_dec, test->nblocks - 1, deciphered_iv + 16, cipher + 16);
+                AES256_CBC_dec_decrypt_iv(&dec_ctx.ctx, iv_dec_eq, 1, deciphered_eq_iv, cipher);
+                AES256_CBC_dec_decrypt_iv(&dec_ctx.ctx, iv_dec_eq, test->nblocks - 1, deciphered_eq_iv + 16, cipher + 16);
                 break;
             }
         }
@@ -174,6 +289,593 @@ int main(void) {
             fprintf(stderr, "D(key=\"%s\", cipher=\"%s\") != \"%s\"\n", test->key, test->cipher, test->plain);
             fail++;
         }
+        if (memcmp(plain, deciphered_eq, test->nblocks * 16)) {
+            fprintf(stderr, "D_eq(key=\"%s\", cipher=\"%s\") != \"%s\"\n", test->key, test->cipher, test->plain);
+            fail++;
+        }
+        if (memcmp(cipher, ciphered_iv, test->nblocks * 16) || memcmp(plain, deciphered_iv, test->nblocks * 16) || memcmp(plain, deciphered_eq_iv, test->nblocks * 16)) {
+            fprintf(stderr, "CBC with separate iv differs for key=\"%s\"\n", test->key);
+            fail++;
+        }
+    }
+    for (v = 0; v < sizeof(ctaes_ctr_tests) / sizeof(ctaes_ctr_tests[0]); v++) {
+        /* Split over two calls at various byte offsets, decrypting in place. */
+        static const int splits[] = {0, 1, 15, 16, 17, 33, 64};
+        unsigned char key[32], counter[16], plain[4 * 16], cipher[4 * 16], ciphered[4 * 16], deciphered[4 * 16];
+        const ctaes_cbc_test* test = &ctaes_ctr_tests[v];
+        int k;
+        from_hex(key, test->keysize / 8, test->key);
+        from_hex(counter, 16, test->iv);
+        from_hex(plain, test->nblocks * 16, test->plain);
+        from_hex(cipher, test->nblocks * 16, test->cipher);
+        for (k = 0; k < (int)(sizeof(splits) / sizeof(splits[0])); k++) {
+            AES_CTR_state enc, dec;
+            int len = test->nblocks * 16;
+            AES_CTR_init(&enc, counter, 32);
+            AES_CTR_init(&dec, counter, 128);
+            memcpy(deciphered, cipher, len);
+            switch (test->keysize) {
+                case 128: {
+                    AES128_ctx ctx;
+                    AES128_init(&ctx, key);
+                    AES128_CTR_crypt(&ctx, &enc, splits[k], ciphered, plain);
+                    AES128_CTR_crypt(&ctx, &enc, len - splits[k], ciphered + splits[k], plain + splits[k]);
+                    AES128_CTR_crypt(&ctx, &dec, splits[k], deciphered, deciphered);
+                    AES128_CTR_crypt(&ctx, &dec, len - splits[k], deciphered + splits[k], deciphered + splits[k]);
+                    break;
+                }
+                case 192: {
+                    AES192_ctx ctx;
+                    AES192_init(&ctx, key);
+                    AES192_CTR_crypt(&ctx, &enc, splits[k], ciphered, plain);
+                    AES192_CTR_crypt(&ctx, &enc, len - splits[k], ciphered + splits[k], plain + splits[k]);
+                    AES192_CTR_crypt(&ctx, &dec, splits[k], deciphered, deciphered);
+                    AES192_CTR_crypt(&ctx, &dec, len - splits[k], deciphered + splits[k], deciphered + splits[k]);
+                    break;
+                }
+                case 256: {
+                    AES256_ctx ctx;
+                    AES256_init(&ctx, key);
+                    AES256_CTR_crypt(&ctx, &enc, splits[k], ciphered, plain);
+                    AES256_CTR_crypt(&ctx, &enc, len - splits[k], ciphered + splits[k], plain + splits[k]);
+                    AES256_CTR_crypt(&ctx, &dec, splits[k], deciphered, deciphered);
+                    AES256_CTR_crypt(&ctx, &dec, len - splits[k], deciphered + splits[k], deciphered + splits[k]);
+                    break;
+                }
+            }
+            if (memcmp(cipher, ciphered, len) || memcmp(plain, deciphered, len)) {
+                fprintf(stderr, "CTR(key=\"%s\") split after %i bytes differs\n", test->key, splits[k]);
+                fail++;
+            }
+        }
+    }
+    {
+        /* The counter must wrap around within its width. */
+        static const int widths[] = {32, 64, 128};
+        unsigned char key[16], counter[16], zero[32], ks[32], expected[16];
+        AES128_ctx ctx;
+        int j, k;
+        for (j = 0; j < 16; j++) {
+            key[j] = j * 5 + 3;
+            counter[j] = 0xff;
+        }
+        memset(zero, 0, sizeof(zero));
+        AES128_init(&ctx, key);
+        for (k = 0; k < 3; k++) {
+            AES_CTR_state state;
+            AES_CTR_init(&state, counter, widths[k]);
+            AES128_CTR_crypt(&ctx, &state, 32, ks, zero);
+            memcpy(expected, counter, 16);
+            memset(expected + 16 - widths[k] / 8, 0, widths[k] / 8);
+            AES128_encrypt(&ctx, 1, expected, expected);
+            if (memcmp(ks + 16, expected, 16)) {
+                fprintf(stderr, "CTR with a %i-bit counter does not wrap around correctly\n", widths[k]);
+                fail++;
+            }
+        }
+        for (k = 0; k < 6; k++) {
+            /* Other widths are rejected, without touching the state or out. */
+            static const int bad_widths[] = {-8, 0, 7, 40, 129, 1000};
+            AES_CTR_state state, state_before;
+            memset(&state, 0x5a, sizeof(state));
+            memcpy(&state_before, &state, sizeof(state));
+            memset(ks, 0x5a, 16);
+            if (AES_CTR_init(&state, counter, bad_widths[k]) || memcmp(&state, &state_before, sizeof(state)) ||
+                AES128_CTR_crypt_at(&ctx, counter, bad_widths[k], 0, 16, ks, zero) || ks[0] != 0x5a || ks[15] != 0x5a) {
+                fprintf(stderr, "CTR accepts a %i-bit counter\n", bad_widths[k]);
+                fail++;
+            }
+        }
+        /* Seeking 2^32 blocks ahead of an all-ones 64-bit counter. */
+        AES128_CTR_crypt_at(&ctx, counter, 64, (uint64_t)16 << 32, 16, ks, zero);
+        memcpy(expected, counter, 16);
+        memset(expected + 8, 0, 4);
+        AES128_encrypt(&ctx, 1, expected, expected);
+        if (memcmp(ks, expected, 16)) {
+            fprintf(stderr, "CTR at an offset of 2^36 bytes differs\n");
+            fail++;
+        }
+    }
+    {
+        /* A long CTR stream, in pieces of various sizes, must match encrypting
+         * the counter blocks. */
+        static const int pieces[] = {1, 5, 16, 100, 1100, 0};
+        unsigned char key[16], counter[16], plain[CBC_BLOCKS * 16], ciphered[CBC_BLOCKS * 16], expected[CBC_BLOCKS * 16];
+        AES128_ctx ctx;
+        AES_CTR_state state;
+        int j, done = 0, len = CBC_BLOCKS * 16 - 9;
+        for (j = 0; j < 16; j++) {
+            key[j] = j * 3 + 7;
+            counter[j] = j == 15 ? 0xf0 : j * 9;
+        }
+        for (j = 0; j < CBC_BLOCKS * 16; j++) {
+            plain[j] = j * 23 + 1;
+        }
+        for (j = 0; j < CBC_BLOCKS; j++) {
+            int k, carry = j;
+            memcpy(expected + 16 * j, counter, 16);
+            for (k = 15; k >= 12; k--) {
+                carry += expected[16 * j + k];
+                expected[16 * j + k] = carry & 0xff;
+                carry >>= 8;
+            }
+        }
+        AES128_init(&ctx, key);
+        AES128_encrypt(&ctx, CBC_BLOCKS, expected, expected);
+        for (j = 0; j < len; j++) {
+            expected[j] ^= plain[j];
+        }
+        AES_CTR_init(&state, counter, 32);
+        for (j = 0; done < len; j++) {
+            int n = pieces[j % 6] < len - done ? pieces[j % 6] : len - done;
+            AES128_CTR_crypt(&ctx, &state, n, ciphered + done, plain + done);
+            done += n;
+        }
+        if (memcmp(ciphered, expected, len)) {
+            fprintf(stderr, "CTR of %i bytes in pieces differs\n", len);
+            fail++;
+        }
+        for (j = 0; j < len; j += 397) {
+            int n = j * 3 % 257 < len - j ? j * 3 % 257 : len - j;
+            memset(ciphered, 0, sizeof(ciphered));
+            AES128_CTR_crypt_at(&ctx, counter, 32, j, n, ciphered, plain + j);
+            if (memcmp(ciphered, expected + j, n)) {
+                fprintf(stderr, "CTR of %i bytes at offset %i differs\n", n, j);
+                fail++;
+            }
+        }
+    }
+    for (i = 0; i < 4; i++) {
+        /* Long CTR calls, which compute the first round once per run of
+         * counter blocks, across runs and wrapping counters of each width.
+         * The last one starts at a run, so the 32-bit counter wraps between
+         * whole runs, and its first call is one whole run. */
+        static unsigned char plain[CTR_BLOCKS * 16], ciphered[CTR_BLOCKS * 16], expected[CTR_BLOCKS * 16];
+        unsigned char key[32], counter[16];
+        int width = i == 1 ? 64 : i == 2 ? 128 : 32, len = CTR_BLOCKS * 16 - 3, split = i == 3 ? 256 * 16 : 7;
+        AES_CTR_state state;
+        AES256_ctx ctx;
+        int j;
+        for (j = 0; j < 32; j++) {
+            key[j] = j * 17 + width;
+        }
+        for (j = 0; j < 16; j++) {
+            counter[j] = j < 16 - width / 8 ? j * 5 + 1 : 0xff;
+        }
+        counter[15] = i == 3 ? 0 : 0x0b;
+        for (j = 0; j < CTR_BLOCKS * 16; j++) {
+            plain[j] = j * 29 + width;
+        }
+        for (j = 0; j < CTR_BLOCKS; j++) {
+            int k, carry = j;
+            memcpy(expected + 16 * j, counter, 16);
+            for (k = 15; k >= 16 - width / 8; k--) {
+                carry += expected[16 * j + k];
+                expected[16 * j + k] = carry & 0xff;
+                carry >>= 8;
+            }
+        }
+        AES256_init(&ctx, key);
+        AES256_encrypt(&ctx, CTR_BLOCKS, expected, expected);
+        for (j = 0; j < len; j++) {
+            expected[j] ^= plain[j];
+        }
+        AES_CTR_init(&state, counter, width);
+        AES256_CTR_crypt(&ctx, &state, split, ciphered, plain);
+        AES256_CTR_crypt(&ctx, &state, len - split, ciphered + split, plain + split);
+        if (memcmp(ciphered, expected, len)) {
+            fprintf(stderr, "CTR of %i bytes with a %i-bit counter differs\n", len, width);
+            fail++;
+        }
+    }
+    for (i = 0; i < 3; i++) {
+        /* Processing many blocks in a single call must match processing them one
+         * by one, which is done with the other setting of AES_set_portable. */
+        unsigned char key[32], plain[MULTI_BLOCKS * 16], ciphered[MULTI_BLOCKS * 16], deciphered[MULTI_BLOCKS * 16], deciphered_eq[MULTI_BLOCKS * 16], single[16];
+        unsigned char ciphered_wide[MULTI_BLOCKS * 16], deciphered_wide[MULTI_BLOCKS * 16];
+        int keysize = 128 + 64 * i;
+        int n, j;
+        for (j = 0; j < 32; j++) {
+            key[j] = j * 29 + keysize;
+        }
+        for (j = 0; j < MULTI_BLOCKS * 16; j++) {
+            plain[j] = j * 37 + 11;
+        }
+        for (n = 0; n <= MULTI_BLOCKS; n++) {
+            int bad = 0;
+            switch (keysize) {
+                case 128: {
+                    AES128_ctx ctx;
+                    AES128_dec_ctx dec_ctx;
+                    AES128_wide_ctx wide_ctx;
+                    AES128_init(&ctx, key);
+                    AES128_dec_init(&dec_ctx, key);
+                    AES128_encrypt(&ctx, n, ciphered, plain);
+                    AES_set_portable(!portable);
+                    for (j = 0; j < n; j++) {
+                        AES128_encrypt(&ctx, 1, single, plain + 16 * j);
+                        bad |= memcmp(single, ciphered + 16 * j, 16);
+                    }
+                    AES_set_portable(portable);
+                    memcpy(deciphered, ciphered, n * 16);
+                    AES128_decrypt(&ctx, n, deciphered, deciphered);
+                    AES128_dec_decrypt(&dec_ctx, n, deciphered_eq, ciphered);
+                    AES128_wide_init(&wide_ctx, key);
+                    AES128_wide_encrypt(&wide_ctx, n, ciphered_wide, plain);
+                    AES128_wide_decrypt(&wide_ctx, n, deciphered_wide, ciphered);
+                    break;
+                }
+                case 192: {
+                    AES192_ctx ctx;
+                    AES192_dec_ctx dec_ctx;
+                    AES192_wide_ctx wide_ctx;
+                    AES192_init(&ctx, key);
+                    AES192_dec_init(&dec_ctx, key);
+                    AES192_encrypt(&ctx, n, ciphered, plain);
+                    AES_set_portable(!portable);
+                    for (j = 0; j < n; j++) {
+                        AES192_encrypt(&ctx, 1, single, plain + 16 * j);
+                        bad |= memcmp(single, ciphered + 16 * j, 16);
+                    }
+                    AES_set_portable(portable);
+                    memcpy(deciphered, ciphered, n * 16);
+                    AES192_decrypt(&ctx, n, deciphered, deciphered);
+                    AES192_dec_decrypt(&dec_ctx, n, deciphered_eq, ciphered);
+                    AES192_wide_init(&wide_ctx, key);
+                    AES192_wide_encrypt(&wide_ctx, n, ciphered_wide, plain);
+                    AES192_wide_decrypt(&wide_ctx, n, deciphered_wide, ciphered);
+                    break;
+                }
+                case 256: {
+                    AES256_ctx ctx;
+                    AES256_dec_ctx dec_ctx;
+                    AES256_wide_ctx wide_ctx;
+                    AES256_init(&ctx, key);
+                    AES256_dec_init(&dec_ctx, key);
+                    AES256_encrypt(&ctx, n, ciphered, plain);
+                    AES_set_portable(!portable);
+                    for (j = 0; j < n; j++) {
+                        AES256_encrypt(&ctx, 1, single, plain + 16 * j);
+                        bad |= memcmp(single, ciphered + 16 * j, 16);
+                    }
+                    AES_set_portable(portable);
+                    memcpy(deciphered, ciphered, n * 16);
+                    AES256_decrypt(&ctx, n, deciphered, deciphered);
+                    AES256_dec_decrypt(&dec_ctx, n, deciphered_eq, ciphered);
+                    AES256_wide_init(&wide_ctx, key);
+                    AES256_wide_encrypt(&wide_ctx, n, ciphered_wide, plain);
+                    AES256_wide_decrypt(&wide_ctx, n, deciphered_wide, ciphered);
+                    break;
+                }
+            }
+            if (bad) {
+                fprintf(stderr, "E(AES-%i, %i blocks) differs from single block encryption\n", keysize, n);
+                fail++;
+            }
+            if (memcmp(plain, deciphered, n * 16)) {
+                fprintf(stderr, "D(E(AES-%i, %i blocks)) differs from plaintext\n", keysize, n);
+                fail++;
+            }
+            if (memcmp(plain, deciphered_eq, n * 16)) {
+                fprintf(stderr, "D_eq(E(AES-%i, %i blocks)) differs from plaintext\n", keysize, n);
+                fail++;
+            }
+            if (memcmp(ciphered, ciphered_wide, n * 16) || memcmp(plain, deciphered_wide, n * 16)) {
+                fprintf(stderr, "E_wide or D_wide(AES-%i, %i blocks) differs\n", keysize, n);
+                fail++;
+            }
+        }
+    }
+    {
+        /* CBC decryption of more blocks than are decrypted at once, in place or
+         * not, and split over calls at various points, must undo encryption. */
+        static const int splits[] = {0, 1, 8, 64, 71, CBC_BLOCKS};
+        unsigned char key[16], iv[16], iv_dec[16], iv_dec_eq[16], plain[CBC_BLOCKS * 16], ciphered[CBC_BLOCKS * 16], deciphered[CBC_BLOCKS * 16], deciphered_eq[CBC_BLOCKS * 16];
+        AES128_ctx ctx;
+        AES128_dec_ctx dec_ctx;
+        int j, k;
+        for (j = 0; j < 16; j++) {
+            key[j] = j * 13 + 1;
+            iv[j] = j * 7 + 2;
+        }
+        for (j = 0; j < CBC_BLOCKS * 16; j++) {
+            plain[j] = j * 43 + 9;
+        }
+        AES128_init(&ctx, key);
+        AES128_dec_init(&dec_ctx, key);
+        memcpy(iv_dec, iv, 16);
+        AES128_CBC_encrypt_iv(&ctx, iv_dec, CBC_BLOCKS, ciphered, plain);
+        for (k = 0; k < (int)(sizeof(splits) / sizeof(splits[0])); k++) {
+            memcpy(iv_dec, iv, 16);
+            memcpy(iv_dec_eq, iv, 16);
+            memcpy(deciphered, ciphered, sizeof(ciphered));
+            AES128_CBC_decrypt_iv(&ctx, iv_dec, splits[k], deciphered, deciphered);
+            AES128_CBC_decrypt_iv(&ctx, iv_dec, CBC_BLOCKS - splits[k], deciphered + splits[k] * 16, deciphered + splits[k] * 16);
+            AES128_CBC_dec_decrypt_iv(&dec_ctx, iv_dec_eq, splits[k], deciphered_eq, ciphered);
+            AES128_CBC_dec_decrypt_iv(&dec_ctx, iv_dec_eq, CBC_BLOCKS - splits[k], deciphered_eq + splits[k] * 16, ciphered + splits[k] * 16);
+            if (memcmp(plain, deciphered, sizeof(plain)) || memcmp(plain, deciphered_eq, sizeof(plain)) || memcmp(iv_dec, ciphered + (CBC_BLOCKS - 1) * 16, 16) || memcmp(iv_dec_eq, iv_dec, 16)) {
+                fprintf(stderr, "CBC decryption of %i blocks split after %i differs\n", CBC_BLOCKS, splits[k]);
+                fail++;
+            }
+        }
+    }
+    {
+        /* Encrypting CBC streams of different lengths together must match
+         * encrypting them one by one. Every third one is encrypted in place. */
+        unsigned char key[16], plain[CBC_STREAMS * 16 * 16], ciphered[CBC_STREAMS * 16 * 16], single[16 * 16];
+        uint8_t iv_data[CBC_STREAMS * 16], iv_single[16];
+        uint8_t* ivs[CBC_STREAMS];
+        size_t blocks[CBC_STREAMS];
+        unsigned char* ciphered_ptrs[CBC_STREAMS];
+        const unsigned char* plain_ptrs[CBC_STREAMS];
+        AES128_ctx ctx;
+        int j;
+        for (j = 0; j < 16; j++) {
+            key[j] = j * 11 + 4;
+        }
+        for (j = 0; j < CBC_STREAMS * 16 * 16; j++) {
+            plain[j] = j * 31 + 6;
+        }
+        for (j = 0; j < CBC_STREAMS * 16; j++) {
+            iv_data[j] = j * 19 + 8;
+        }
+        memcpy(ciphered, plain, sizeof(plain));
+        for (j = 0; j < CBC_STREAMS; j++) {
+            ivs[j] = iv_data + 16 * j;
+            blocks[j] = (j * 7) % 17;
+            ciphered_ptrs[j] = ciphered + 256 * j;
+            plain_ptrs[j] = j % 3 ? plain + 256 * j : ciphered + 256 * j;
+        }
+        AES128_init(&ctx, key);
+        AES128_CBC_encrypt_streams(&ctx, CBC_STREAMS, ivs, blocks, ciphered_ptrs, plain_ptrs);
+        for (j = 0; j < CBC_STREAMS; j++) {
+            int k;
+            for (k = 0; k < 16; k++) {
+                iv_single[k] = (j * 16 + k) * 19 + 8;
+            }
+            AES128_CBC_encrypt_iv(&ctx, iv_single, blocks[j], single, plain + 256 * j);
+            if (memcmp(single, ciphered + 256 * j, blocks[j] * 16) || memcmp(iv_single, ivs[j], 16)) {
+                fprintf(stderr, "AES128_CBC_encrypt_streams differs for stream %i\n", j);
+                fail++;
+            }
+        }
+    }
+    {
+        /* Setting up many contexts at once must match setting them up one by one. */
+        unsigned char keys[MULTI_KEYS * 32];
+        AES128_ctx ctx128[MULTI_KEYS], single128;
+        AES192_ctx ctx192[MULTI_KEYS], single192;
+        AES256_ctx ctx256[MULTI_KEYS], single256;
+        int j;
+        for (j = 0; j < MULTI_KEYS * 32; j++) {
+            keys[j] = j * 41 + 3;
+        }
+        AES128_init_many(ctx128, MULTI_KEYS, keys);
+        AES192_init_many(ctx192, MULTI_KEYS, keys);
+        AES256_init_many(ctx256, MULTI_KEYS, keys);
+        for (j = 0; j < MULTI_KEYS; j++) {
+            AES128_init(&single128, keys + 16 * j);
+            AES192_init(&single192, keys + 24 * j);
+            AES256_init(&single256, keys + 32 * j);
+            if (memcmp(&single128, &ctx128[j], sizeof(single128)) || memcmp(&single192, &ctx192[j], sizeof(single192)) || memcmp(&single256, &ctx256[j], sizeof(single256))) {
+                fprintf(stderr, "AES*_init_many differs from AES*_init for key %i\n", j);
+                fail++;
+            }
+        }
+    }
+    {
+        /* Key stores must hold the contexts AES*_init_many sets up, and be
+         * rejected when changed in any way. */
+        unsigned char keys[MULTI_KEYS * 16];
+        AES128_ctx ctxs[MULTI_KEYS];
+        size_t len = AES128_keystore_size(MULTI_KEYS), n;
+        unsigned char* store = malloc(len);
+        const AES128_ctx* opened;
+        int j;
+        for (j = 0; j < MULTI_KEYS * 16; j++) {
+            keys[j] = j * 47 + 5;
+        }
+        AES128_init_many(ctxs, MULTI_KEYS, keys);
+        /* The contexts, and so the stores, only hold the bit sliced round keys. */
+        if (sizeof(AES128_ctx) != 11 * 16 || sizeof(AES192_ctx) != 13 * 16 || sizeof(AES256_ctx) != 15 * 16 || len != 32 + MULTI_KEYS * sizeof(AES128_ctx)) {
+            fprintf(stderr, "Contexts or key stores have an unexpected size\n");
+            fail++;
+        }
+        if (!AES128_keystore_build(store, MULTI_KEYS, keys)) {
+            fprintf(stderr, "Cannot build a key store\n");
+            fail++;
+        } else {
+            opened = AES128_keystore_open(store, len, &n);
+            if (opened == NULL || n != MULTI_KEYS || memcmp(opened, ctxs, sizeof(ctxs))) {
+                fprintf(stderr, "Key store differs from AES128_init_many\n");
+                fail++;
+            }
+            if (AES128_keystore_open(store, len - 16, &n) || AES192_keystore_open(store, len, &n) || AES128_keystore_open(store + 1, len - 1, &n) || n != 0) {
+                fprintf(stderr, "Opened key store with the wrong length, key size or alignment\n");
+                fail++;
+            }
+            for (j = 0; j < (int)len; j += 61) {
+                store[j] ^= 0x10;
+                if (AES128_keystore_open(store, len, &n)) {
+                    fprintf(stderr, "Opened key store with byte %i changed\n", j);
+                    fail++;
+                }
+                store[j] ^= 0x10;
+            }
+        }
+        free(store);
+    }
+    for (i = 0; i < 3; i++) {
+        /* Processing blocks with many contexts at once must match processing them
+         * one by one, also when the output overwrites the input. */
+        unsigned char keys[MULTI_KEYS * 32], plain[MULTI_KEYS * 16], ciphered[MULTI_KEYS * 16], deciphered[MULTI_KEYS * 16], single[16];
+        unsigned char* ciphered_ptrs[MULTI_KEYS];
+        unsigned char* deciphered_ptrs[MULTI_KEYS];
+        const unsigned char* plain_ptrs[MULTI_KEYS];
+        AES128_ctx ctx128[MULTI_KEYS];
+        AES192_ctx ctx192[MULTI_KEYS];
+        AES256_ctx ctx256[MULTI_KEYS];
+        const AES128_ctx* ctx128_ptrs[MULTI_KEYS];
+        const AES192_ctx* ctx192_ptrs[MULTI_KEYS];
+        const AES256_ctx* ctx256_ptrs[MULTI_KEYS];
+        int keysize = 128 + 64 * i;
+        int bad = 0;
+        int j;
+        for (j = 0; j < MULTI_KEYS * 32; j++) {
+            keys[j] = j * 43 + keysize;
+        }
+        for (j = 0; j < MULTI_KEYS * 16; j++) {
+            plain[j] = j * 31 + 7;
+        }
+        /* Use the contexts in a different order than the blocks. */
+        for (j = 0; j < MULTI_KEYS; j++) {
+            ciphered_ptrs[j] = ciphered + 16 * j;
+            deciphered_ptrs[j] = deciphered + 16 * j;
+            plain_ptrs[j] = plain + 16 * j;
+            ctx128_ptrs[j] = &ctx128[(j * 5) % MULTI_KEYS];
+            ctx192_ptrs[j] = &ctx192[(j * 5) % MULTI_KEYS];
+            ctx256_ptrs[j] = &ctx256[(j * 5) % MULTI_KEYS];
+        }
+        switch (keysize) {
+            case 128:
+                AES128_init_many(ctx128, MULTI_KEYS, keys);
+                AES128_encrypt_many(ctx128_ptrs, MULTI_KEYS, ciphered_ptrs, plain_ptrs);
+                for (j = 0; j < MULTI_KEYS; j++) {
+                    AES128_encrypt(ctx128_ptrs[j], 1, single, plain_ptrs[j]);
+                    bad |= memcmp(single, ciphered_ptrs[j], 16);
+                }
+                memcpy(deciphered, ciphered, sizeof(ciphered));
+                AES128_decrypt_many(ctx128_ptrs, MULTI_KEYS, deciphered_ptrs, (const unsigned char* const*)deciphered_ptrs);
+                break;
+            case 192:
+                AES192_init_many(ctx192, MULTI_KEYS, keys);
+                AES192_encrypt_many(ctx192_ptrs, MULTI_KEYS, ciphered_ptrs, plain_ptrs);
+                for (j = 0; j < MULTI_KEYS; j++) {
+                    AES192_encrypt(ctx192_ptrs[j], 1, single, plain_ptrs[j]);
+                    bad |= memcmp(single, ciphered_ptrs[j], 16);
+                }
+                memcpy(deciphered, ciphered, sizeof(ciphered));
+                AES192_decrypt_many(ctx192_ptrs, MULTI_KEYS, deciphered_ptrs, (const unsigned char* const*)deciphered_ptrs);
+                break;
+            case 256:
+                AES256_init_many(ctx256, MULTI_KEYS, keys);
+                AES256_encrypt_many(ctx256_ptrs, MULTI_KEYS, ciphered_ptrs, plain_ptrs);
+                for (j = 0; j < MULTI_KEYS; j++) {
+                    AES256_encrypt(ctx256_ptrs[j], 1, single, plain_ptrs[j]);
+                    bad |= memcmp(single, ciphered_ptrs[j], 16);
+                }
+                memcpy(deciphered, ciphered, sizeof(ciphered));
+                AES256_decrypt_many(ctx256_ptrs, MULTI_KEYS, deciphered_ptrs, (const unsigned char* const*)deciphered_ptrs);
+                break;
+        }
+        if (bad) {
+            fprintf(stderr, "E_many(AES-%i) differs from single block encryption\n", keysize);
+            fail++;
+        }
+        if (memcmp(plain, deciphered, sizeof(plain))) {
+            fprintf(stderr, "D_many(E_many(AES-%i)) differs from plaintext\n", keysize);
+            fail++;
+        }
+    }
+    return fail;
+}
+
+/* Create an empty temporary file for the tuning tests, and write its name to
+ * path, of L_tmpnam + 32 bytes. Returns 0 on failure. */
+static int temp_path(char* path) {
+#if defined(__unix__) || defined(__APPLE__)
+    int fd;
+    strcpy(path, "/tmp/ctaes_tuning_XXXXXX");
+    fd = mkstemp(path);
+    if (fd < 0) {
+        return 0;
+    }
+    close(fd);
+    return 1;
+#else
+    return tmpnam(path) != NULL;
+#endif
+}
+
+int main(void) {
+    /* With and without the code for instruction set extensions. */
+    int fail = run_tests(0) + run_tests(1);
+    const char* name;
+    char tuning_path[L_tmpnam + 32];
+    size_t i;
+    /* And with every implementation on its own. */
+    for (i = 0; (name = AES_backend_name(i)) != NULL; i++) {
+        if (!AES_set_backend(name)) {
+            fprintf(stderr, "Cannot select backend %s\n", name);
+            fail++;
+        }
+        fail += run_tests(0);
+    }
+    if (AES_set_backend("none") || !AES_set_backend(NULL)) {
+        fprintf(stderr, "AES_set_backend accepts unknown backends\n");
+        fail++;
+    }
+    /* And with the choices of the autotuner, also after saving and loading them. */
+    AES_autotune();
+    fail += run_tests(0);
+    if (!temp_path(tuning_path)) {
+        fprintf(stderr, "Cannot create a temporary file for the tuning\n");
+        fail++;
+    } else {
+        int saved = AES_autotune_save(tuning_path), loaded = saved && AES_autotune_load(tuning_path);
+        remove(tuning_path);
+        if (!loaded) {
+            fprintf(stderr, "Cannot save and load tuning\n");
+            fail++;
+        }
+        fail += run_tests(0);
+        if (AES_autotune_load(tuning_path)) {
+            fprintf(stderr, "Loaded missing tuning\n");
+            fail++;
+        }
+        for (i = 0; i < 200; i++) {
+            /* Whatever the timings, the tuning must be one that loads again,
+             * also when a wider implementation takes over from fewer blocks
+             * than a narrower one added before it. */
+            double overhead[16], per_block[16];
+            unsigned long seed = i * 2654435761UL + 1;
+            size_t k;
+            for (k = 0; k < 16; k++) {
+                seed = seed * 1103515245UL + 12345;
+                overhead[k] = ((seed >> 8) & 1023) * 1e-9;
+                seed = seed * 1103515245UL + 12345;
+                per_block[k] = (((seed >> 8) & 1023) + 1) * 1e-11;
+            }
+            AES_autotune_timings(overhead, per_block);
+            saved = AES_autotune_save(tuning_path);
+            loaded = saved && AES_autotune_load(tuning_path);
+            remove(tuning_path);
+            if (!loaded) {
+                fprintf(stderr, "Cannot save and load the tuning for timings %lu\n", (unsigned long)i);
+                fail++;
+            }
+        }
+        fail += run_tests(0);
     }
     if (fail == 0) {
         fprintf(stderr, "All tests successful\n");